@@ -0,0 +1,24 @@
+# - Compile an lp script into an executable
+#
+#  lp_program(NAME SCRIPT)
+#
+#  translates SCRIPT with `main --emit-c` into NAME.c in the current binary
+#  directory and builds the executable NAME from it with the system C
+#  compiler, linked against the lprt runtime
+
+find_package(Threads REQUIRED)
+
+function(lp_program NAME SCRIPT)
+  get_filename_component(_script ${SCRIPT} ABSOLUTE)
+  set(_source ${CMAKE_CURRENT_BINARY_DIR}/${NAME}.c)
+  add_custom_command(OUTPUT ${_source}
+    COMMAND main --emit-c ${_source} ${_script}
+    DEPENDS main ${_script}
+    COMMENT "Translating ${SCRIPT} to C")
+  add_executable(${NAME} ${_source})
+  target_link_libraries(${NAME} lprt ${CMAKE_THREAD_LIBS_INIT})
+  if ("${CMAKE_C_COMPILER_ID}" STREQUAL "GNU" OR
+      "${CMAKE_C_COMPILER_ID}" MATCHES  "Clang")
+    target_compile_options(${NAME} PRIVATE -std=c99 -O2 -Wall)
+  endif()
+endfunction()
@@ -0,0 +1,404 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "scan.h"
+#include "emit.h"
+
+// translates an analyzed program to C that runs on the runtime of rt.c:
+// every fun becomes a C function over the env_t of its frame, variables
+// are read through the prev links the analysis resolved them to, and every
+// check fails with the token and message the interpreter would use
+
+typedef struct {
+  void ** list;
+  size_t len;
+  size_t capa;
+} list_t;
+
+typedef struct {
+  FILE * out;   // the functions, written ahead of the tables they use
+  list_t defs;  // funs, in the order their functions are written
+  list_t toks;  // tokens the checks point at
+  size_t temps; // names taken so far
+  int err;      // an allocation failed
+} emit_t;
+
+// the index of item in list, which takes it at its end
+static size_t
+push(emit_t * e, list_t * l, void * item) {
+  if (l->len + 1 > l->capa) {
+    size_t request = l->capa ? l->capa * 2 : 64;
+    void ** list = realloc(l->list, sizeof(* list) * request);
+    if (list == NULL) return e->err = 1, 0;
+    l->list = list, l->capa = request;
+  }
+  return l->list[l->len] = item, l->len++;
+}
+
+static void
+line(emit_t * e, int depth, const char * fmt, ...) {
+  va_list ap;
+  fprintf(e->out, "%*s", depth * 2, "");
+  va_start(ap, fmt);
+  vfprintf(e->out, fmt, ap);
+  va_end(ap);
+  fputc('\n', e->out);
+}
+
+static void expr(emit_t * e, node_t * node, const char * dst,
+                 const char * prev, const char * stack, int depth);
+
+// a check of the type of temporary n, failing at the token of node
+static void
+check(emit_t * e, int depth, size_t n, const char * type, node_t * node,
+      const char * what) {
+  line(e, depth, "if (obj_type(t%zu) != %s)", n, type);
+  line(e, depth + 1, "return fail(%zu, \"%s\\n\");",
+       push(e, &e->toks, &node->tok), what);
+}
+
+// a new frame for the closure called, its arguments evaluated with the
+// frame already on the stack
+static void
+call(emit_t * e, node_t * node, const char * dst, const char * prev,
+     const char * stack, int d) {
+  node_t * caller = node->front;
+  size_t n = e->temps++, len = 0;
+  char t[32], env[32];
+  snprintf(t, sizeof(t), "t%zu", n), snprintf(env, sizeof(env), "e%zu", n);
+  for (node_t * arg = caller->next; arg != NULL; arg = arg->next) len++;
+  line(e, d, "{");
+  line(e, d + 1, "obj_t t%zu;", n);
+  expr(e, caller, t, prev, stack, d + 1);
+  check(e, d + 1, n, "OBJ_FUN", caller, "variable is not function");
+  line(e, d + 1, "fun_t * c%zu = obj_f(t%zu);", n, n);
+  line(e, d + 1, "def_t * d%zu = &c%zu->node->val.d;", n, n);
+  line(e, d + 1, "if (d%zu->len != %zu)", n, len);
+  line(e, d + 2, "return fail(%zu, \"parameters length do not match\\n\");",
+       push(e, &e->toks, &node->tok));
+  line(e, d + 1, "env_t * e%zu = gc_alloc(gc, c%zu->env, %s, d%zu->env);",
+       n, n, stack, n);
+  line(e, d + 1, "if (e%zu == NULL) return 1;", n);
+  line(e, d + 1, "if (gc_add(gc, e%zu, &e%zu->id)) return env_free(e%zu), 1;",
+       n, n, n);
+  size_t i = 0;
+  for (node_t * arg = caller->next; arg != NULL; arg = arg->next, i++) {
+    size_t m = e->temps++;
+    char a[32];
+    snprintf(a, sizeof(a), "t%zu", m);
+    line(e, d + 1, "{");
+    line(e, d + 2, "obj_t t%zu;", m);
+    expr(e, arg, a, prev, env, d + 2);
+    line(e, d + 2, "var_t v%zu = {0, d%zu->args[%zu]};", m, n, i);
+    line(e, d + 2, "if (env_set(e%zu, &v%zu, &t%zu, gc)) return 1;", n, m, m);
+    line(e, d + 1, "}");
+  }
+  line(e, d + 1, "if (((code_t *) c%zu->node)->code(e%zu, gc, &%s)) return 1;",
+       n, n, dst);
+  line(e, d, "}");
+}
+
+// one of NOD_LT to NOD_NOT, operands checked one by one as calc() does
+static void
+operate(emit_t * e, node_t * node, int type, const char * dst,
+        const char * prev, const char * stack, int d) {
+  static const char * ops[] = {
+    [NOD_LT] = "<", [NOD_GT] = ">", [NOD_EQ] = "==",
+    [NOD_ADD] = "add", [NOD_SUB] = "sub", [NOD_MUL] = "mul",
+    [NOD_DIV] = "idiv", [NOD_MOD] = "mod",
+    [NOD_AND] = "&&", [NOD_OR] = "||", [NOD_NOT] = "!",
+  };
+  int bol = type >= NOD_AND;
+  size_t n = e->temps++, ptok = push(e, &e->toks, &node->tok);
+  char t[32];
+  snprintf(t, sizeof(t), "t%zu", n);
+  line(e, d, "{");
+  line(e, d + 1, "obj_t t%zu;", n);
+  line(e, d + 1, "int a%zu;", n);
+  for (node_t * arg = node->front->next; arg != NULL; arg = arg->next) {
+    expr(e, arg, t, prev, stack, d + 1);
+    check(e, d + 1, n, bol ? "OBJ_BOL" : "OBJ_INT", arg,
+          bol ? "variable is not boolean" : "variable is not integer");
+    if (arg == node->front->next)
+      line(e, d + 1, "a%zu = obj_i(t%zu);", n, n);
+    else if (type >= NOD_ADD && type <= NOD_MOD)
+      line(e, d + 1, "if (%s(a%zu, obj_i(t%zu), &toks[%zu], file, &a%zu)) "
+           "return 1;", ops[type], n, n, ptok, n);
+    else
+      line(e, d + 1, "a%zu = a%zu %s obj_i(t%zu);", n, n, ops[type], n);
+  }
+  if (type == NOD_NOT) line(e, d + 1, "a%zu = !a%zu;", n, n);
+  line(e, d + 1, "%s = %s(a%zu);", dst,
+       type >= NOD_ADD && type <= NOD_MOD ? "mkint" : "mkbol", n);
+  line(e, d, "}");
+}
+
+static void
+builtin(emit_t * e, node_t * node, const char * dst, const char * prev,
+        const char * stack, int d) {
+  int id = node->val.i;
+  size_t n = e->temps++, i = 0;
+  line(e, d, "{");
+  line(e, d + 1, "obj_t v%zu[3];", n);
+  fprintf(e->out, "%*stok_t * k%zu[4] = {&toks[%zu]", (d + 1) * 2, "", n,
+          push(e, &e->toks, &node->tok));
+  for (node_t * arg = node->front->next; arg != NULL; arg = arg->next)
+    fprintf(e->out, ", &toks[%zu]", push(e, &e->toks, &arg->tok));
+  fprintf(e->out, "};\n");
+  line(e, d + 1, "size_t r%zu = gc->vrlen;", n);
+  for (node_t * arg = node->front->next; arg != NULL; arg = arg->next, i++) {
+    char v[32];
+    snprintf(v, sizeof(v), "v%zu[%zu]", n, i);
+    expr(e, arg, v, prev, stack, d + 1);
+    line(e, d + 1, "if (vec_check(%d, %zu, v%zu[%zu], k%zu[%zu], gc, file)) "
+         "return 1;", id, i, n, i, n, i + 1);
+  }
+  line(e, d + 1, "gc->vrlen = r%zu;", n);
+  line(e, d + 1, "if (vec_apply(%d, k%zu, v%zu, gc, file, &%s)) return 1;",
+       id, n, n, dst);
+  line(e, d, "}");
+}
+
+static void
+branch(emit_t * e, node_t * stmt, const char * dst, const char * prev,
+       const char * stack, int d) {
+  expr(e, stmt, dst, prev, stack, d);
+  line(e, d, "if (%s == OBJ_NIL)", dst);
+  line(e, d + 1, "return fail(%zu, "
+       "\"the return value of if-else statement is nil\\n\");",
+       push(e, &e->toks, &stmt->tok));
+}
+
+// statements that leave the value of node in dst, evaluated in the frame
+// prev with stack as the innermost frame of the collector's roots
+static void
+expr(emit_t * e, node_t * node, const char * dst, const char * prev,
+     const char * stack, int d) {
+  int type = node->type == NOD_QOP ? node->val.q.op :
+             node->type == NOD_QIF ? NOD_IF : node->type;
+  size_t n = e->temps++;
+  char t[32];
+  snprintf(t, sizeof(t), "t%zu", n);
+  if (type == NOD_INT) {
+    line(e, d, "%s = mkint(%d);", dst, node->val.i);
+  } else if (type == NOD_BOL) {
+    line(e, d, "%s = mkbol(%d);", dst, node->val.i);
+  } else if (type == NOD_VAR) {
+    fprintf(e->out, "%*s%s = %s", d * 2, "", dst, prev);
+    for (size_t i = 0; i < node->val.v.env; i++) fprintf(e->out, "->prev");
+    fprintf(e->out, "->locs[%zu].obj;\n", node->val.v.off);
+  } else if (type == NOD_DEF) {
+    line(e, d, "{");
+    line(e, d + 1, "fun_t * c%zu = fun_get(&defs[%zu].node, %s);", n,
+         push(e, &e->defs, node), prev);
+    line(e, d + 1, "if (c%zu == NULL) return 1;", n);
+    line(e, d + 1, "%s = mkfun(c%zu);", dst, n);
+    line(e, d, "}");
+  } else if (type == NOD_FUN) {
+    call(e, node, dst, prev, stack, d);
+  } else if (type == NOD_INL) {
+    line(e, d, "%s = OBJ_NIL;", dst);
+    for (node_t * stmt = node->front->next; stmt != NULL; stmt = stmt->next)
+      expr(e, stmt, dst, prev, stack, d);
+  } else if (type == NOD_SET) {
+    node_t * name = node->front->next;
+    line(e, d, "{");
+    line(e, d + 1, "obj_t t%zu;", n);
+    expr(e, name->next, t, prev, stack, d + 1);
+    line(e, d + 1, "var_t v%zu = {%zu, %zu};", n, name->val.v.env,
+         name->val.v.off);
+    line(e, d + 1, "if (env_set(%s, &v%zu, &t%zu, gc)) return 1;", prev, n, n);
+    line(e, d + 1, "%s = OBJ_NIL;", dst);
+    line(e, d, "}");
+  } else if (type == NOD_IF) {
+    node_t * cond = node->front->next;
+    line(e, d, "{");
+    line(e, d + 1, "obj_t t%zu;", n);
+    expr(e, cond, t, prev, stack, d + 1);
+    check(e, d + 1, n, "OBJ_BOL", cond, "variable is not boolean");
+    line(e, d + 1, "if (obj_i(t%zu)) {", n);
+    branch(e, cond->next, dst, prev, stack, d + 2);
+    line(e, d + 1, "} else {");
+    branch(e, cond->next->next, dst, prev, stack, d + 2);
+    line(e, d + 1, "}");
+    line(e, d, "}");
+  } else if (type == NOD_WHL) {
+    node_t * cond = node->front->next;
+    line(e, d, "for (;;) {");
+    line(e, d + 1, "obj_t t%zu;", n);
+    expr(e, cond, t, prev, stack, d + 1);
+    check(e, d + 1, n, "OBJ_BOL", cond, "variable is not boolean");
+    line(e, d + 1, "if (!obj_i(t%zu)) break;", n);
+    for (node_t * stmt = cond->next; stmt != NULL; stmt = stmt->next)
+      expr(e, stmt, dst, prev, stack, d + 1);
+    line(e, d, "}");
+    line(e, d, "%s = OBJ_NIL;", dst);
+  } else if (type >= NOD_LT && type <= NOD_NOT) {
+    operate(e, node, type, dst, prev, stack, d);
+  } else if (type == NOD_PRN || type == NOD_PRB) {
+    int num = type == NOD_PRN;
+    line(e, d, "{");
+    line(e, d + 1, "obj_t t%zu;", n);
+    expr(e, node->front->next, t, prev, stack, d + 1);
+    check(e, d + 1, n, num ? "OBJ_INT" : "OBJ_BOL", node->front->next,
+          num ? "the argument of print-num is not integer" :
+                "the argument of print-bool is not boolean");
+    if (num) line(e, d + 1, "printf(\"%%d\\n\", obj_i(t%zu));", n);
+    else line(e, d + 1, "puts(obj_i(t%zu) ? \"#t\" : \"#f\");", n);
+    line(e, d + 1, "%s = OBJ_NIL;", dst);
+    line(e, d, "}");
+  } else if (type == NOD_VEC) {
+    builtin(e, node, dst, prev, stack, d);
+  } else {
+    line(e, d, "return 1;");
+  }
+}
+
+// the source as a C string, a line of it per line of the literal
+static void
+quote(FILE * out, const char * str, size_t len) {
+  fprintf(out, "\"");
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = (unsigned char) str[i];
+    if (c == '\n') fprintf(out, i + 1 < len ? "\\n\"\n  \"" : "\\n");
+    else if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+    else if (c >= ' ' && c < 127 && c != '?') fputc(c, out);
+    else fprintf(out, "\\%03o", c);
+  }
+  fprintf(out, "\"");
+}
+
+// the tables the functions use, then the functions and main
+static int
+program(emit_t * e, FILE * out, const char * str, size_t len,
+       const char * file, size_t globals, size_t tops) {
+  fprintf(out, "// translated from %s by main --emit-c\n\n", file);
+  fprintf(out, "#include <stdio.h>\n#include \"rt.h\"\n\n");
+  fprintf(out, "#define fail(k, ...) (error((&toks[k]), file, __VA_ARGS__), 1)"
+          "\n\n");
+  fprintf(out, "typedef struct {\n  node_t node; // keys the closures\n"
+          "  int (* code)(env_t * env, gc_t * gc, obj_t * obj);\n"
+          "} code_t;\n\n");
+  fprintf(out, "static const char * const file = ");
+  quote(out, file, strlen(file));
+  fprintf(out, ";\n\nstatic const char src[] =\n  ");
+  quote(out, str, len);
+  fprintf(out, ";\n\nstatic tok_t toks[] = {\n");
+  for (size_t i = 0; i < e->toks.len; i++) {
+    tok_t * tok = e->toks.list[i];
+    fprintf(out, "  {src + %zu, %u, %d},\n", (size_t) (tok->begin - str),
+            (unsigned) tok->len, tok->id);
+  }
+  if (!e->toks.len) fprintf(out, "  {src, 0, 0},\n");
+  fprintf(out, "};\n\n");
+  for (size_t i = 0; i < e->defs.len; i++)
+    fprintf(out, "static int f%zu(env_t * env, gc_t * gc, obj_t * obj);\n",
+            i);
+  for (size_t i = 0; i < e->defs.len; i++) {
+    def_t * def = &((node_t *) e->defs.list[i])->val.d;
+    if (!def->len) continue;
+    fprintf(out, "%sstatic size_t a%zu[] = {", i ? "" : "\n", i);
+    for (size_t j = 0; j < def->len; j++)
+      fprintf(out, "%s%zu", j ? ", " : "", def->args[j]);
+    fprintf(out, "};\n");
+  }
+  fprintf(out, "\nstatic code_t defs[] = {\n");
+  for (size_t i = 0; i < e->defs.len; i++) {
+    def_t * def = &((node_t *) e->defs.list[i])->val.d;
+    fprintf(out, "  {{.type = NOD_DEF, .val.d = {.args = ");
+    if (def->len) fprintf(out, "a%zu", i);
+    else fprintf(out, "NULL");
+    fprintf(out, ", .len = %zu, .env = %zu}}, f%zu},\n", def->len, def->env,
+            i);
+  }
+  if (!e->defs.len) fprintf(out, "  {{.type = NOD_NIL}, NULL},\n");
+  fprintf(out, "};\n\n");
+  // the functions, as written so far
+  rewind(e->out);
+  char buf[BUFSIZ];
+  for (size_t n; (n = fread(buf, 1, sizeof(buf), e->out)) > 0;)
+    if (fwrite(buf, 1, n, out) != n) return 1;
+  fprintf(out, "static int (* const tops[])(env_t * env, gc_t * gc) = {\n");
+  for (size_t i = 0; i < tops; i++) fprintf(out, "  top%zu,\n", i);
+  if (!tops) fprintf(out, "  NULL,\n");
+  fprintf(out, "};\n\n");
+  fprintf(out, "int\nmain(void) {\n"
+          "  // frames are allocated in a nursery and collected by generation\n"
+          "  opt.gc_gen = 1;\n"
+          "  (void) file, (void) toks, (void) defs; // not all are used\n"
+          "  env_t * env = env_new(NULL, NULL, %zu);\n"
+          "  if (env == NULL) return 1;\n"
+          "  gc_t * gc = gc_heap();\n"
+          "  if (gc == NULL) return env_free(env), 1;\n"
+          "  if (gc_add(gc, env, &env->id)) return gc_release(gc), "
+          "env_free(env), 1;\n"
+          "  int err = lines_add(NULL, src, sizeof(src) - 1);\n"
+          "  for (size_t i = 0; !err && i < %zu; i++) err = tops[i](env, gc);\n"
+          "  gc_release(gc);\n"
+          "  lines_drop(src);\n"
+          "  return err;\n"
+          "}\n", globals, tops);
+  return ferror(e->out) || ferror(out);
+}
+
+// the function of every fun found so far, and of those they hold
+static void
+funs(emit_t * e) {
+  for (size_t i = 0; i < e->defs.len; i++) {
+    node_t * def = e->defs.list[i];
+    line(e, 0, "static int\nf%zu(env_t * env, gc_t * gc, obj_t * obj) {", i);
+    line(e, 1, "* obj = OBJ_NIL;");
+    for (node_t * stmt = def->front->next->next; stmt != NULL;
+         stmt = stmt->next)
+      expr(e, stmt, "* obj", "env", "env", 1);
+    line(e, 1, "return 0;");
+    line(e, 0, "}\n");
+  }
+}
+
+// writes the program of root, analyzed from str, as C to out
+static int
+translate(node_t * root, size_t globals, const char * str, size_t len,
+          const char * file, FILE * out) {
+  emit_t e = {tmpfile(), {NULL, 0, 0}, {NULL, 0, 0}, 0, 0};
+  if (e.out == NULL) return 1;
+  size_t tops = 0, forms = 0;
+  for (node_t * node = root->front; node != NULL; node = node->next) {
+    if (forms++ % EMIT_TOP == 0) {
+      if (tops) line(&e, 1, "return (void) obj, 0;"), line(&e, 0, "}\n");
+      line(&e, 0, "static int\ntop%zu(env_t * env, gc_t * gc) {", tops++);
+      line(&e, 1, "obj_t obj;");
+    }
+    expr(&e, node, "obj", "env", "env", 1);
+  }
+  if (tops) line(&e, 1, "return (void) obj, 0;"), line(&e, 0, "}\n");
+  funs(&e);
+  int err = e.err || program(&e, out, str, len, file, globals, tops);
+  return fclose(e.out), free(e.defs.list), free(e.toks.list), err;
+}
+
+// analyzes the script at path and writes its translation to target, "-"
+// for stdout
+int
+emit_c(const char * path, const char * target) {
+  FILE * in = fopen(path, "rb");
+  if (in == NULL) return perror(path), 1;
+  size_t size;
+  char * str = slurp(in, &size);
+  fclose(in);
+  if (str == NULL) return 1;
+  node_t * root = node_new(NULL, NOD_NIL);
+  if (root == NULL) return free(str), 1;
+  map_t map;
+  map_init(&map, NULL);
+  int err = lines_add(NULL, str, size) || analyze(str, root, &map, path);
+  lines_drop(str);
+  if (!err) {
+    FILE * out = strcmp(target, "-") ? fopen(target, "w") : stdout;
+    if (out == NULL) perror(target), err = 1;
+    else err = translate(root, map.len, str, size, path, out);
+    if (out != NULL && out != stdout && fclose(out)) err = 1;
+  }
+  return map_free(&map), node_free(root), free(str), err;
+}
@@ -0,0 +1,8 @@
+#ifndef EMIT_H
+#define EMIT_H
+
+#define EMIT_TOP 64 // top-level forms per function of the translation
+
+int emit_c(const char * path, const char * target);
+
+#endif
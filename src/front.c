@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "scan.h"
+#include "stats.h"
+#include "mem.h"
+
+typedef struct {
+  const char ** forms; // opening parens
+  size_t len;
+  size_t capa;
+  size_t depth;
+} split_t;
+
+typedef struct {
+  const char * str;
+  size_t forms; // top-level forms to parse from str
+  node_t * root;
+  int err;
+} task_t;
+
+static int
+form(split_t * s, const char * p) {
+  if (s->len + 1 > s->capa) {
+    size_t request = s->capa ? s->capa * 2 : 64;
+    const char ** forms =
+        mem_realloc(MEM_AST, s->forms, sizeof(* forms) * request);
+    if (forms == NULL) return 1;
+    s->forms = forms, s->capa = request;
+  }
+  return s->forms[s->len++] = p, 0;
+}
+
+// anything but blanks between forms, or unbalanced parens, fails the split
+// and leaves the error to the sequential parser
+static int
+step(split_t * s, const char * p) {
+  char c = * p;
+  if (c == '(') {
+    if (!s->depth && form(s, p)) return 1;
+    s->depth++;
+  } else if (c == ')') {
+    if (!s->depth) return 1;
+    s->depth--;
+  } else if (!s->depth && c != ' ' && c != '\t' && c != '\n') {
+    return 1;
+  }
+  return 0;
+}
+
+// finds the top-level forms of str by paren depth
+static int
+split(split_t * s, const char * str, size_t len) {
+  const char * p = str, * end = str + len;
+#ifdef __SSE2__
+  const __m128i lp = _mm_set1_epi8('('), rp = _mm_set1_epi8(')');
+  const __m128i nl = _mm_set1_epi8('\n'), sp = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    int parens = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, lp),
+                                                _mm_cmpeq_epi8(v, rp)));
+    int blanks = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, nl),
+        _mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab))));
+    if (parens || (!s->depth && blanks != 0xffff))
+      for (size_t i = 0; i < 16; i++)
+        if (step(s, p + i)) return 1;
+  }
+#endif
+  for (; p < end; p++)
+    if (step(s, p)) return 1;
+  return s->depth != 0;
+}
+
+// the forms are counted once joined, the counters are not shared safely
+static void *
+task(void * arg) {
+  task_t * t = arg;
+  int quiet = stats_quiet;
+  stats_quiet = 1;
+  t->err = (t->root = node_new(NULL, NOD_NIL)) == NULL;
+  for (size_t i = 0; i < t->forms && !t->err; i++)
+    t->err = parse(&t->str, t->root, NULL);
+  stats_quiet = quiet;
+  return NULL;
+}
+
+// tokens and nodes of a subtree, for the stats the workers may not touch
+static void
+count(node_t * node, size_t * toks, size_t * nodes) {
+  for (; node != NULL; node = node->next) {
+    (* toks)++, (* nodes)++;
+    if (node->tok.id == TOK_LPAREN)
+      (* toks)++, count(node->front, toks, nodes);
+  }
+}
+
+// parses the forms in blocks of about equal size, one per thread, and
+// appends them to parent in source order
+static int
+parse_blocks(split_t * s, size_t len, node_t * parent, size_t threads) {
+  task_t * tasks = mem_calloc(MEM_AST, threads, sizeof(* tasks));
+  pthread_t * ids = mem_alloc(MEM_AST, sizeof(* ids) * threads);
+  if (tasks == NULL || ids == NULL)
+    return mem_free(tasks), mem_free(ids), 1;
+  size_t n = 0, i = 0, started = 0;
+  const char * base = s->forms[0];
+  for (; n < threads && i < s->len; n++) {
+    task_t * t = &tasks[n];
+    t->str = s->forms[i];
+    const char * limit = base + len / threads * (n + 1);
+    for (; i < s->len && (n + 1 == threads || s->forms[i] < limit); i++)
+      t->forms++;
+  }
+  int err = n == 0 || i < s->len;
+  for (; !err && started + 1 < n; started++)
+    if (pthread_create(&ids[started], NULL, task, &tasks[started + 1])) break;
+  if (!err) task(&tasks[0]), err = tasks[0].err;
+  for (size_t j = 0; j < started; j++)
+    pthread_join(ids[j], NULL), err |= tasks[j + 1].err;
+  for (size_t j = started + 1; !err && j < n; j++)
+    task(&tasks[j]), err = tasks[j].err;
+  for (size_t j = 0; j < n; j++) {
+    node_t * root = tasks[j].root;
+    if (root == NULL) continue;
+    if (err) { node_free(root); continue; }
+    for (node_t * node = root->front; node != NULL; node = node->next)
+      node->parent = parent;
+    if (root->front != NULL) {
+      if (parent->front == NULL) parent->front = root->front;
+      else parent->back->next = root->front;
+      parent->back = root->back;
+    }
+    STATS(count(root->front, &stats.toks, &stats.nodes));
+    mem_free(root);
+  }
+  return mem_free(tasks), mem_free(ids), err;
+}
+
+int
+parse_par(const char ** str, node_t * parent, const char * file,
+          size_t threads) {
+  size_t len = strlen(* str);
+  if (threads > 1 && len >= PARSE_PAR_MIN) {
+    split_t s = {NULL, 0, 0, 0};
+    int err = split(&s, * str, len) || !s.len ||
+              parse_blocks(&s, len, parent, threads);
+    mem_free(s.forms);
+    if (!err) return * str += len, 0;
+  }
+  return parse_all(str, parent, file);
+}
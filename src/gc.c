@@ -0,0 +1,523 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "scan.h"
+#include "stats.h"
+#include "mem.h"
+
+// a Chase-Lev deque: the owner pushes and pops at the bottom without
+// locking, thieves race for the top with a compare and swap; items holds
+// every env of the heap, each is pushed at most once a cycle, so it never
+// fills up nor wraps around
+typedef struct {
+  env_t ** items;
+  size_t   capa;
+  size_t   top;    // thieves take from here
+  size_t   bottom; // the owner pushes and pops here
+} deque_t;
+
+typedef struct {
+  struct gc_pool * pool;
+  size_t id;
+} worker_t;
+
+struct gc_pool {
+  gc_t *      gc;
+  size_t      len;     // deques, one per thread including the mutator
+  deque_t *   deques;
+  worker_t *  workers;
+  pthread_t * threads;
+  size_t      started; // workers below started are running, and so is the
+                       // sweeper once it is nonzero
+  size_t      pending; // greyed but not yet scanned environments
+  size_t      epoch;   // bumped to start a parallel mark
+  size_t      running; // workers still marking
+  int         quit;
+  pthread_mutex_t lock;
+  pthread_cond_t  start;
+  pthread_cond_t  done;
+  // background sweep
+  pthread_t   sweeper;
+  env_t **    dead;    // handed to the sweeper
+  size_t      dlen;
+  size_t      dcapa;
+  env_t **    batch;   // filled by the mutator during a sweep
+  size_t      blen;
+  size_t      bcapa;
+  pthread_cond_t sweep;
+};
+
+static void
+deque_push(deque_t * deque, env_t * env) {
+  size_t b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+  __atomic_store_n(&deque->items[b], env, __ATOMIC_RELAXED);
+  __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELEASE);
+}
+
+// the owner's end, the last item is raced for with the thieves
+static env_t *
+deque_pop(deque_t * deque) {
+  size_t b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+  if (!b) return NULL;
+  // the store must be seen before top is read, or a thief and the owner
+  // could both take the last item
+  __atomic_store_n(&deque->bottom, --b, __ATOMIC_SEQ_CST);
+  size_t t = __atomic_load_n(&deque->top, __ATOMIC_SEQ_CST);
+  if (t > b) {
+    __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+  env_t * env = __atomic_load_n(&deque->items[b], __ATOMIC_RELAXED);
+  if (t < b) return env;
+  if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, 0,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    env = NULL;
+  __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+  return env;
+}
+
+// NULL if empty or another thread won the item
+static env_t *
+deque_steal(deque_t * deque) {
+  size_t t = __atomic_load_n(&deque->top, __ATOMIC_SEQ_CST);
+  size_t b = __atomic_load_n(&deque->bottom, __ATOMIC_SEQ_CST);
+  if (t >= b) return NULL;
+  env_t * env = __atomic_load_n(&deque->items[t], __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, 0,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    return NULL;
+  return env;
+}
+
+// greys env unless another thread got there first
+static void
+grey(struct gc_pool * pool, deque_t * deque, env_t * env) {
+  if (env == NULL) return;
+  char * mark = &pool->gc->addrs[env->id].mark;
+  if (__atomic_exchange_n(mark, GC_MARK, __ATOMIC_ACQ_REL) == GC_MARK) return;
+  __atomic_add_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+  deque_push(deque, env);
+}
+
+static void
+mark(struct gc_pool * pool, size_t id) {
+  deque_t * own = &pool->deques[id];
+  for (;;) {
+    env_t * env = deque_pop(own);
+    for (size_t i = 1; env == NULL && i < pool->len; i++)
+      env = deque_steal(&pool->deques[(id + i) % pool->len]);
+    if (env == NULL) {
+      if (!__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE)) return;
+      sched_yield();
+      continue;
+    }
+    grey(pool, own, env->prev);
+    for (size_t i = 0; i < env->len; i++) {
+      obj_t obj = env->locs[i].obj;
+      if (obj_type(obj) == OBJ_FUN) grey(pool, own, obj_f(obj)->env);
+      else if (obj_type(obj) == OBJ_VEC)
+        __atomic_store_n(&obj_v(obj)->mark, GC_MARK, __ATOMIC_RELAXED);
+    }
+    __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+  }
+}
+
+static void *
+work(void * arg) {
+  worker_t * worker = arg;
+  struct gc_pool * pool = worker->pool;
+  size_t epoch = 0;
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (pool->epoch == epoch && !pool->quit)
+      pthread_cond_wait(&pool->start, &pool->lock);
+    if (pool->quit) break;
+    epoch = pool->epoch;
+    pthread_mutex_unlock(&pool->lock);
+    mark(pool, worker->id);
+    pthread_mutex_lock(&pool->lock);
+    if (!--pool->running) pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+static void *
+sweep(void * arg) {
+  struct gc_pool * pool = arg;
+  env_t ** dead = NULL;
+  size_t capa = 0;
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->dlen && !pool->quit)
+      pthread_cond_wait(&pool->sweep, &pool->lock);
+    if (!pool->dlen) break;
+    env_t ** ptr = pool->dead;
+    size_t len = pool->dlen, pcapa = pool->dcapa;
+    pool->dead = dead, pool->dcapa = capa, pool->dlen = 0;
+    dead = ptr, capa = pcapa;
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < len; i++) env_release(dead[i]);
+    pthread_mutex_lock(&pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  mem_free(dead);
+  return NULL;
+}
+
+struct gc_pool *
+gc_pool_new(gc_t * gc, size_t threads) {
+  struct gc_pool * pool = mem_calloc(MEM_GC, 1, sizeof(* pool));
+  if (pool == NULL) return NULL;
+  pool->gc = gc, pool->len = threads;
+  pool->deques = mem_calloc(MEM_GC, threads, sizeof(* pool->deques));
+  pool->workers = mem_calloc(MEM_GC, threads, sizeof(* pool->workers));
+  pool->threads = mem_calloc(MEM_GC, threads, sizeof(* pool->threads));
+  if (pool->deques == NULL || pool->workers == NULL || pool->threads == NULL)
+    return mem_free(pool->deques), mem_free(pool->workers),
+           mem_free(pool->threads), mem_free(pool), NULL;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pthread_cond_init(&pool->sweep, NULL);
+  if (pthread_create(&pool->sweeper, NULL, sweep, pool))
+    return gc_pool_free(pool), NULL;
+  // thread 0 is the mutator itself
+  for (pool->started = 1; pool->started < threads; pool->started++) {
+    size_t i = pool->started;
+    pool->workers[i] = (worker_t) {.pool = pool, .id = i};
+    if (pthread_create(&pool->threads[i], NULL, work, &pool->workers[i]))
+      return gc_pool_free(pool), NULL;
+  }
+  return pool;
+}
+
+void
+gc_pool_free(struct gc_pool * pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_cond_signal(&pool->sweep);
+  pthread_mutex_unlock(&pool->lock);
+  for (size_t i = 1; i < pool->started; i++)
+    pthread_join(pool->threads[i], NULL);
+  if (pool->started) pthread_join(pool->sweeper, NULL);
+  for (size_t i = 0; i < pool->len; i++) mem_free(pool->deques[i].items);
+  mem_free(pool->deques), mem_free(pool->workers), mem_free(pool->threads);
+  mem_free(pool->dead), mem_free(pool->batch);
+  mem_free(pool);
+}
+
+int
+gc_mark_par(gc_t * gc, env_t * prev, env_t * stack) {
+  struct gc_pool * pool = gc->pool;
+  for (size_t i = 0; i < pool->len; i++) {
+    deque_t * deque = &pool->deques[i];
+    if (deque->capa < gc->len) {
+      env_t ** items =
+          mem_realloc(MEM_GC, deque->items, sizeof(* items) * gc->len);
+      if (items == NULL) return 1;
+      deque->items = items, deque->capa = gc->len;
+    }
+    deque->top = deque->bottom = 0;
+  }
+  pool->pending = 0;
+  grey(pool, &pool->deques[0], prev);
+  for (env_t * e = stack; e != NULL; e = e->ret)
+    grey(pool, &pool->deques[0], e);
+  pthread_mutex_lock(&pool->lock);
+  pool->running = pool->len - 1, pool->epoch++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  mark(pool, 0);
+  pthread_mutex_lock(&pool->lock);
+  while (pool->running) pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+  return 0;
+}
+
+// queues a dead environment for the sweeper, freeing it here if out of memory
+void
+gc_dead(gc_t * gc, env_t * env) {
+  struct gc_pool * pool = gc->pool;
+  if (pool->blen + 1 > pool->bcapa) {
+    size_t request = pool->bcapa ? pool->bcapa * 2 : 64;
+    env_t ** batch =
+        mem_realloc(MEM_GC, pool->batch, sizeof(* batch) * request);
+    if (batch == NULL) { env_release(env); return; }
+    pool->batch = batch, pool->bcapa = request;
+  }
+  pool->batch[pool->blen++] = env;
+}
+
+// hands the dead environments of this cycle to the sweeper
+void
+gc_sweep(gc_t * gc) {
+  struct gc_pool * pool = gc->pool;
+  if (!pool->blen) return;
+  pthread_mutex_lock(&pool->lock);
+  if (!pool->dlen) {
+    env_t ** dead = pool->dead;
+    size_t capa = pool->dcapa;
+    pool->dead = pool->batch, pool->dcapa = pool->bcapa;
+    pool->dlen = pool->blen;
+    pool->batch = dead, pool->bcapa = capa, pool->blen = 0;
+    pthread_cond_signal(&pool->sweep);
+    pthread_mutex_unlock(&pool->lock);
+    return;
+  }
+  // the sweeper is behind, append to its queue
+  if (pool->dlen + pool->blen > pool->dcapa) {
+    size_t request = (pool->dlen + pool->blen) * 2;
+    env_t ** dead = mem_realloc(MEM_GC, pool->dead, sizeof(* dead) * request);
+    if (dead == NULL) {
+      pthread_mutex_unlock(&pool->lock);
+      for (size_t i = 0; i < pool->blen; i++) env_release(pool->batch[i]);
+      pool->blen = 0;
+      return;
+    }
+    pool->dead = dead, pool->dcapa = request;
+  }
+  memcpy(pool->dead + pool->dlen, pool->batch,
+         sizeof(* pool->dead) * pool->blen);
+  pool->dlen += pool->blen, pool->blen = 0;
+  pthread_cond_signal(&pool->sweep);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+#define CHUNK_SIZE (64 * 1024)
+
+struct chunk {
+  struct chunk *   link; // every chunk of the nursery
+  struct chunk *   next; // free chunks
+  struct nursery * nursery;
+  size_t live;           // envs allocated here and not freed yet
+  size_t used;           // bump pointer
+  char   data[];
+};
+
+struct nursery {
+  struct chunk * cur;  // chunk being bumped
+  struct chunk * free; // chunks whose envs all died
+  struct chunk * all;
+};
+
+struct nursery *
+gc_nursery_new(void) {
+  return mem_calloc(MEM_ENV, 1, sizeof(struct nursery));
+}
+
+void
+gc_nursery_free(struct nursery * nursery) {
+  while (nursery->all != NULL) {
+    struct chunk * chunk = nursery->all;
+    nursery->all = chunk->link, mem_free(chunk);
+  }
+  mem_free(nursery);
+}
+
+// env and its locs in one block bumped from the nursery, large frames and
+// allocations without a nursery go to env_new()
+env_t *
+gc_alloc(gc_t * gc, env_t * prev, env_t * ret, size_t len) {
+  struct nursery * nursery = gc->nursery;
+  size_t need = (sizeof(env_t) + sizeof(loc_t) * len + 15) & ~(size_t) 15;
+  if (nursery == NULL || need > CHUNK_SIZE) return env_new(prev, ret, len);
+  struct chunk * chunk = nursery->cur;
+  if (chunk == NULL || chunk->used + need > CHUNK_SIZE) {
+    // a full chunk with live envs is left to gc_chunk_release()
+    if ((chunk = nursery->free) != NULL) {
+      nursery->free = chunk->next;
+    } else {
+      chunk = mem_alloc(MEM_ENV, sizeof(* chunk) + CHUNK_SIZE);
+      if (chunk == NULL) return NULL;
+      chunk->link = nursery->all, nursery->all = chunk;
+      chunk->nursery = nursery;
+    }
+    chunk->live = chunk->used = 0;
+    if (nursery->cur != NULL && !nursery->cur->live) {
+      nursery->cur->next = nursery->free, nursery->free = nursery->cur;
+    }
+    nursery->cur = chunk;
+  }
+  env_t * env = (env_t *) (chunk->data + chunk->used);
+  chunk->used += need, chunk->live++;
+  env->locs = (loc_t *) (env + 1);
+  for (size_t i = 0; i < len; i++) env->locs[i].obj = OBJ_NIL;
+  env->ret = ret;
+  env->prev = prev;
+  env->len = len;
+  env->chunk = chunk;
+  env->rem = 0;
+  env->refs = 1;
+  env->funs = NULL;
+  if (prev != NULL && gc->rc) prev->refs++;
+  STATS(
+    size_t live = ++stats.envs_new - stats.envs_free;
+    if (live > stats.envs_peak) stats.envs_peak = live);
+  return env;
+}
+
+void
+gc_chunk_release(struct chunk * chunk) {
+  struct nursery * nursery = chunk->nursery;
+  if (--chunk->live) return;
+  if (chunk == nursery->cur) chunk->used = 0;
+  else chunk->next = nursery->free, nursery->free = chunk;
+}
+
+int
+gc_remember(gc_t * gc, env_t * env) {
+  if (env->rem) return 0;
+  if (gc->rlen + 1 > gc->rcapa) {
+    size_t request = gc->rcapa ? gc->rcapa * 2 : 64;
+    env_t ** rem = mem_realloc(MEM_GC, gc->rem, sizeof(* rem) * request);
+    if (rem == NULL) return 1;
+    gc->rem = rem, gc->rcapa = request;
+  }
+  return env->rem = 1, gc->rem[gc->rlen++] = env, 0;
+}
+
+static void
+young(gc_t * gc, env_t * env) {
+  if (env != NULL && env->id >= gc->old) gc_push(gc, env);
+}
+
+// collects the envs tracked since the last collection; roots are the stack,
+// prev and the remembered set, and every survivor is promoted
+int
+gc_minor(gc_t * gc, env_t * prev, env_t * stack) {
+  double begin = stats_clock();
+  if (gc->len > gc->wcapa) {
+    env_t ** work = mem_realloc(MEM_GC, gc->work, sizeof(* work) * gc->len);
+    if (work == NULL) return 1;
+    gc->work = work, gc->wcapa = gc->len;
+  }
+  for (size_t i = gc->old; i < gc->len; i++) gc->addrs[i].mark = GC_NIL;
+  gc->wlen = 0;
+  young(gc, prev);
+  // frames are older than their callees, the first old one ends the young part
+  for (env_t * e = stack; e != NULL && e->id >= gc->old; e = e->ret)
+    young(gc, e);
+  for (size_t i = 0; i < gc->rlen; i++) {
+    env_t * e = gc->rem[i];
+    for (size_t j = 0; j < e->len; j++) {
+      obj_t obj = e->locs[j].obj;
+      if (obj_type(obj) == OBJ_FUN) young(gc, obj_f(obj)->env);
+    }
+    e->rem = 0;
+  }
+  gc->rlen = 0;
+  while (gc->wlen) {
+    env_t * e = gc->work[--gc->wlen];
+    young(gc, e->prev);
+    for (size_t i = 0; i < e->len; i++) {
+      obj_t obj = e->locs[i].obj;
+      if (obj_type(obj) == OBJ_FUN) young(gc, obj_f(obj)->env);
+    }
+  }
+  gc->old = gc_compact(gc, gc->old);
+  STATS(stats.gc_minor++, stats_pause(stats_lap(PHA_GC, begin) - begin));
+  return 0;
+}
+
+// removes env from the table, the last entry takes its place
+static void
+untrack(gc_t * gc, env_t * env) {
+  addr_t * last = &gc->addrs[--gc->len];
+  gc->addrs[env->id] = * last;
+  last->val->id = env->id;
+}
+
+// drops a reference to env and frees it, and whatever only it kept alive,
+// when none is left; keep is the env of a closure being returned, which no
+// count covers yet, and is left to the tracing collector instead; 1 with
+// the reference kept if there is no memory for the walk
+int
+gc_unref(gc_t * gc, env_t * env, env_t * keep) {
+  if (--env->refs || env == keep) return 0;
+  if (gc->len > gc->wcapa) {
+    env_t ** work = mem_realloc(MEM_GC, gc->work, sizeof(* work) * gc->len);
+    if (work == NULL) return env->refs++, 1;
+    gc->work = work, gc->wcapa = gc->len;
+  }
+  size_t len = 0;
+  gc->work[len++] = env;
+  while (len) {
+    env_t * e = gc->work[--len], * to = e->prev;
+    if (to != NULL && !--to->refs && to != keep) gc->work[len++] = to;
+    for (size_t i = 0; i < e->len; i++) {
+      if (obj_type(e->locs[i].obj) != OBJ_FUN) continue;
+      to = obj_f(e->locs[i].obj)->env;
+      if (!--to->refs && to != keep) gc->work[len++] = to;
+    }
+    untrack(gc, e);
+    env_free(e);
+  }
+  return 0;
+}
+
+// after marking, releases the references unmarked envs hold on marked ones
+void
+gc_drop_dead(gc_t * gc) {
+  for (size_t i = 0; i < gc->len; i++) {
+    env_t * e = gc->addrs[i].val, * to = e->prev;
+    if (gc->addrs[i].mark == GC_MARK) continue;
+    if (to != NULL && gc->addrs[to->id].mark == GC_MARK) to->refs--;
+    for (size_t j = 0; j < e->len; j++) {
+      if (obj_type(e->locs[j].obj) != OBJ_FUN) continue;
+      to = obj_f(e->locs[j].obj)->env;
+      if (gc->addrs[to->id].mark == GC_MARK) to->refs--;
+    }
+  }
+}
+
+// a vector of len zeroed elements, tracked for full cycles; vectors made
+// during an incremental cycle are black like envs
+vec_t *
+gc_vec(gc_t * gc, size_t len) {
+  if (len > (SIZE_MAX - sizeof(vec_t)) / sizeof(int32_t)) return NULL;
+  size_t size = sizeof(vec_t) + sizeof(int32_t) * len;
+  if (gc->vlen + 1 > gc->vcapa) {
+    size_t request = gc->vcapa ? gc->vcapa * 2 : 8;
+    vec_t ** vecs = mem_realloc(MEM_GC, gc->vecs, sizeof(* vecs) * request);
+    if (vecs == NULL) return NULL;
+    gc->vecs = vecs, gc->vcapa = request;
+  }
+  vec_t * vec = mem_calloc(MEM_VEC, 1, size);
+  if (vec == NULL) return NULL;
+  vec->len = len, vec->task = gc->task;
+  vec->mark = gc->phase == GC_MARKING ? GC_MARK : GC_NIL;
+  gc->vbytes += size;
+  return gc->vecs[gc->vlen++] = vec;
+}
+
+// keeps vec alive until vrlen is restored, builtins hold their operands
+// here while evaluating the next one
+int
+gc_protect(gc_t * gc, vec_t * vec) {
+  if (gc->vrlen + 1 > gc->vrcapa) {
+    size_t request = gc->vrcapa ? gc->vrcapa * 2 : 8;
+    vec_t ** roots = mem_realloc(MEM_GC, gc->vroots, sizeof(* roots) * request);
+    if (roots == NULL) return 1;
+    gc->vroots = roots, gc->vrcapa = request;
+  }
+  return gc->vroots[gc->vrlen++] = vec, 0;
+}
+
+// frees the vectors no marked env or builtin holds, after a full cycle
+void
+gc_vec_sweep(gc_t * gc) {
+  for (size_t i = 0; i < gc->vrlen; i++) gc->vroots[i]->mark = GC_MARK;
+  size_t len = 0, bytes = 0;
+  for (size_t i = 0; i < gc->vlen; i++) {
+    vec_t * vec = gc->vecs[i];
+    if (vec->mark != GC_MARK) { mem_free(vec); continue; }
+    gc->vecs[len++] = vec;
+    bytes += sizeof(vec_t) + sizeof(int32_t) * vec->len;
+  }
+  gc->vlen = len, gc->vbytes = bytes;
+  gc->vnext = bytes * 2 > GC_VEC_MIN ? bytes * 2 : GC_VEC_MIN;
+}
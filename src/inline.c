@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <string.h>
+#include "scan.h"
+#include "stats.h"
+#include "mem.h"
+
+// calls of small functions known at the call site are replaced by their
+// bodies, which then run in the frame of the caller: the parameters and
+// locals of the callee get slots at the end of that frame, its variables
+// are renumbered to match and the arguments are stored by defines. Known
+// are funs applied where they are written and globals defined to a fun by
+// a top-level form of their own, which has run by the time a later form
+// does. Top-level code is left alone, its frame holds the globals
+
+typedef struct {
+  size_t sets;     // defines of the global
+  int inner;       // defined from inside a function body too
+  int top;         // the define is a top-level form
+  size_t form;     // which one
+  node_t * value;
+} slot_t;
+
+typedef struct {
+  slot_t * slots;
+  size_t form;     // top-level form being walked
+  node_t * frame;  // def whose frame the nodes run in, NULL at the top level
+  size_t depth;    // frames between that one and the globals
+  int loop;        // inside a while of that frame
+  int changed;     // a call in that frame was inlined
+} walk_t;
+
+// records the defines of globals, as memo_analyze() does
+static void
+sets(walk_t * w, node_t * node, size_t depth, int top) {
+  if (node->type == NOD_SET) {
+    var_t * var = &node->front->next->val.v;
+    if (var->env == depth) {
+      slot_t * slot = &w->slots[var->off];
+      if (depth) slot->inner = 1;
+      slot->sets++, slot->top = top, slot->form = w->form;
+      slot->value = node->front->next->next;
+    }
+  }
+  for (node_t * n = node->front; n != NULL; n = n->next)
+    sets(w, n, depth + (node->type == NOD_DEF), 0);
+}
+
+// nodes under and after node, with whether any of them is a def in defs
+static size_t
+weigh(node_t * node, int * defs) {
+  size_t n = 0;
+  for (; node != NULL; node = node->next) {
+    if (node->type == NOD_DEF) * defs = 1;
+    n += 1 + weigh(node->front, defs);
+  }
+  return n;
+}
+
+// whether the nodes read global off, depth frames up from the first
+static int
+refers(node_t * node, size_t depth, size_t off) {
+  for (; node != NULL; node = node->next)
+    if (node->type == NOD_VAR && node->val.v.env == depth &&
+        node->val.v.off == off) return 1;
+    else if (refers(node->front, depth + (node->type == NOD_DEF), off))
+      return 1;
+  return 0;
+}
+
+// a variable level frames in from the inlined body, read from its frame
+// now at base or from around it, up frames further
+static void
+move(var_t * v, size_t level, size_t base, size_t up) {
+  if (v->env == level) v->off += base;
+  else if (v->env > level) v->env = v->env - 1 + up;
+}
+
+// appends copies of node and those after it to parent
+static int
+copy(node_t * node, node_t * parent, size_t level, size_t base, size_t up) {
+  for (; node != NULL; node = node->next) {
+    // a def is one once it has arguments of its own to free
+    int type = node->type == NOD_DEF ? NOD_NIL : node->type;
+    node_t * n = node_new(parent, type);
+    if (n == NULL) return 1;
+    node_add(parent, n);
+    n->tok = node->tok, n->val = node->val;
+    if (type == NOD_VAR) {
+      move(&n->val.v, level, base, up);
+    } else if (type == NOD_QOP) {
+      if (n->val.q.a.var) move(&n->val.q.a.v, level, base, up);
+      if (n->val.q.b.var) move(&n->val.q.b.v, level, base, up);
+    } else if (node->type == NOD_DEF) {
+      def_t * def = &n->val.d;
+      size_t * args = mem_alloc(MEM_AST, sizeof(* args) * def->len);
+      if (args == NULL) return 1;
+      memcpy(args, def->args, sizeof(* args) * def->len);
+      def->args = args, def->map = NULL, def->memo = NULL;
+      n->type = NOD_DEF;
+    }
+    size_t in = level + (node->type == NOD_DEF);
+    if (copy(node->front, n, in, base, up)) return 1;
+  }
+  return 0;
+}
+
+// the def run by call, if it may be inlined where the walk is, with the
+// frames from there up to the one it closes over in up
+static node_t *
+known(walk_t * w, node_t * call, size_t * up) {
+  node_t * caller = call->front, * fn;
+  if (caller->type == NOD_DEF) {
+    fn = caller, * up = 0;
+  } else if (caller->type == NOD_VAR && caller->val.v.env == w->depth) {
+    size_t off = caller->val.v.off;
+    slot_t * slot = &w->slots[off];
+    if (slot->sets != 1 || slot->inner || !slot->top ||
+        slot->form >= w->form || slot->value->type != NOD_DEF ||
+        refers(slot->value->front, 1, off)) return NULL;
+    fn = slot->value, * up = w->depth;
+  } else {
+    return NULL;
+  }
+  def_t * def = &fn->val.d;
+  size_t len = 0;
+  for (node_t * arg = caller->next; arg != NULL; arg = arg->next) len++;
+  // a closure made in a loop would share the slots of every iteration
+  int defs = 0;
+  if (len != def->len || def->scope != NULL || def->memo != NULL ||
+      weigh(fn->front->next->next, &defs) > INLINE_SIZE || (defs && w->loop))
+    return NULL;
+  return fn;
+}
+
+// turns call into the body of fn storing its arguments first, the caller
+// is kept in front for the reader of the tree and never evaluated
+static int
+expand(walk_t * w, node_t * call, node_t * fn, size_t up) {
+  def_t * def = &fn->val.d, * frame = &w->frame->val.d;
+  size_t base = frame->env;
+  node_t * tmp = node_new(NULL, NOD_NIL), * head;
+  if (tmp == NULL) return 1;
+  int type = call->front->type == NOD_VAR ? NOD_VAR : NOD_NIL;
+  if ((head = node_new(tmp, type)) == NULL) return node_free(tmp), 1;
+  head->tok = call->front->tok, head->val = call->front->val;
+  node_add(tmp, head);
+  node_t * param = fn->front->next->front;
+  for (size_t i = 0; i < def->len; i++, param = param->next) {
+    node_t * set = node_new(tmp, NOD_SET), * kw, * name;
+    if (set == NULL) return node_free(tmp), 1;
+    node_add(tmp, set);
+    if ((kw = node_new(set, NOD_ID)) == NULL) return node_free(tmp), 1;
+    node_add(set, kw);
+    if ((name = node_new(set, NOD_VAR)) == NULL) return node_free(tmp), 1;
+    node_add(set, name);
+    set->tok = kw->tok = name->tok = param->tok;
+    name->val.v = (var_t) {.env = 0, .off = base + def->args[i]};
+  }
+  if (copy(fn->front->next->next, tmp, 0, base, up))
+    return node_free(tmp), 1;
+  // the arguments become the values of the defines
+  node_t * arg = call->front->next, * set = head->next;
+  while (arg != NULL) {
+    node_t * next = arg->next;
+    arg->next = NULL, arg->parent = set, node_add(set, arg);
+    arg = next, set = set->next;
+  }
+  // fn goes with the caller if it was written there
+  frame->env += def->env;
+  call->front->next = NULL, node_free(call->front);
+  call->front = tmp->front, call->back = tmp->back, call->type = NOD_INL;
+  for (node_t * n = call->front; n != NULL; n = n->next) n->parent = call;
+  tmp->front = NULL, node_free(tmp);
+  STATS(stats.calls_inlined++);
+  return w->changed = 1, 0;
+}
+
+static int
+walk(walk_t * w, node_t * node) {
+  if (node->type == NOD_DEF) {
+    walk_t in = * w;
+    in.frame = node, in.depth++, in.loop = 0, in.changed = 0;
+    for (node_t * n = node->front; n != NULL; n = n->next)
+      if (walk(&in, n)) return 1;
+    def_t * def = &node->val.d;
+    if (in.changed) def->pure = !effects(node->front->next->next, 1);
+    return 0;
+  }
+  int loop = w->loop;
+  w->loop |= node->type == NOD_WHL;
+  for (node_t * n = node->front; n != NULL; n = n->next)
+    if (walk(w, n)) return 1;
+  w->loop = loop;
+  if (node->type != NOD_FUN) return 0;
+  size_t up;
+  node_t * fn = w->frame != NULL ? known(w, node, &up) : NULL;
+  if (fn != NULL) return expand(w, node, fn, up);
+  // whether the arguments may run in parallel, as they are now
+  return node->val.i = spread(node->front->next), 0;
+}
+
+// inlines the small functions called in the forms of root, which have
+// been analyzed but not quickened; globals is the length of their map
+int
+inline_calls(node_t * root, size_t globals) {
+  walk_t w = {mem_calloc(MEM_AST, globals + 1, sizeof(slot_t)),
+              0, NULL, 0, 0, 0};
+  if (w.slots == NULL) return 1;
+  for (node_t * form = root->front; form != NULL; form = form->next, w.form++)
+    sets(&w, form, 0, 1);
+  w.form = 0;
+  for (node_t * form = root->front; form != NULL; form = form->next, w.form++)
+    if (walk(&w, form)) return mem_free(w.slots), 1;
+  return mem_free(w.slots), 0;
+}
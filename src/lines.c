@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "scan.h"
+#include "mem.h"
+
+// tokens only keep where they begin, so a diagnostic finds its line by
+// looking the token up in the sources registered here; the index of line
+// starts of a source is built the first time it is needed. parallel tasks
+// keep quiet, so sources are registered and looked up on one thread
+typedef struct text {
+  struct text * next;
+  const char * name; // reported in place of the caller's, if any
+  const char * str;
+  size_t len;
+  size_t * starts;   // offsets of the line starts, NULL until looked up
+  size_t lines;
+} text_t;
+
+static text_t * texts;
+
+int
+lines_add(const char * name, const char * str, size_t len) {
+  text_t * text = mem_alloc(MEM_AST, sizeof(* text));
+  if (text == NULL) return 1;
+  * text = (text_t) {texts, name, str, len, NULL, 0};
+  return texts = text, 0;
+}
+
+void
+lines_drop(const char * str) {
+  for (text_t ** p = &texts; * p != NULL; p = &(* p)->next)
+    if ((* p)->str == str) {
+      text_t * text = * p;
+      * p = text->next;
+      mem_free(text->starts), mem_free(text);
+      return;
+    }
+}
+
+// newlines in str, a 16-byte block at a time
+static size_t
+count(const char * str, size_t len) {
+  size_t n = 0, i = 0;
+#ifdef __SSE2__
+  const __m128i nl = _mm_set1_epi8('\n');
+  for (; len - i >= 16; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (str + i));
+    n += (size_t) __builtin_popcount(
+        (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+  }
+#endif
+  for (; i < len; i++) n += str[i] == '\n';
+  return n;
+}
+
+static int
+index_build(text_t * text) {
+  const char * str = text->str;
+  size_t len = text->len, n = 1, i = 0;
+  size_t * starts = mem_alloc(MEM_AST, sizeof(* starts) *
+                              (count(str, len) + 1));
+  if (starts == NULL) return 1;
+  starts[0] = 0;
+#ifdef __SSE2__
+  const __m128i nl = _mm_set1_epi8('\n');
+  for (; len - i >= 16; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (str + i));
+    unsigned mask = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+    for (; mask; mask &= mask - 1)
+      starts[n++] = i + (size_t) __builtin_ctz(mask) + 1;
+  }
+#endif
+  for (; i < len; i++)
+    if (str[i] == '\n') starts[n++] = i + 1;
+  return text->starts = starts, text->lines = n, 0;
+}
+
+// the line holding at and its number from 0, with the name its source was
+// registered under, or NULL; at stands for its own line if it is unknown
+int
+lines_find(const char * at, const char ** name,
+           const char ** line, size_t * lnum) {
+  * name = NULL, * line = at, * lnum = 0;
+  text_t * text = texts;
+  for (; text != NULL; text = text->next)
+    if (at >= text->str && at <= text->str + text->len) break;
+  if (text == NULL || (text->starts == NULL && index_build(text))) return 1;
+  size_t off = (size_t) (at - text->str), lo = 0, hi = text->lines;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (text->starts[mid] <= off) lo = mid;
+    else hi = mid;
+  }
+  return * name = text->name, * line = text->str + text->starts[lo],
+         * lnum = lo, 0;
+}
@@ -1,7 +1,117 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "scan.h"
+#include "stats.h"
+#include "prof.h"
+#include "memo.h"
+#include "serve.h"
+#include "emit.h"
+#include "watch.h"
+
+static const char * folded;
+static int memo_report_on;
+
+// the reports asked for, once a script has run
+static int
+finish(void) {
+  fflush(stdout);
+  if (opt.stats) stats_dump(stderr);
+  if (opt.prof) {
+    if (folded == NULL) {
+      prof_report(stderr);
+    } else {
+      FILE * out = fopen(folded, "w");
+      if (out == NULL) return perror(folded), prof_free(), 1;
+      prof_folded(out);
+      fclose(out);
+    }
+    prof_free();
+  }
+  if (memo_report_on) memo_report(stderr);
+  memo_free();
+  return 0;
+}
+
+// refuses to run with options a and b together
+static int
+conflict(const char * a, const char * b) {
+  return fprintf(stderr, "error: %s cannot be used with %s\n", a, b), 1;
+}
 
 int
 main(int argc, char ** argv) {
-  return argc == 2 ? exec(argv[1]) : 1;
+  const char * path = NULL, * sock = NULL, * target = NULL;
+  int remote = 0, watching = 0;
+  size_t workers = 0;
+  for (int i = 1; i < argc; i++)
+    if (!strcmp(argv[i], "--stats")) opt.stats = 1;
+    else if (!strcmp(argv[i], "--hw-counters")) opt.stats = opt.hw = 1;
+    else if (!strcmp(argv[i], "--prof")) opt.prof = 1;
+    else if (!strcmp(argv[i], "--prof-folded") && i + 1 < argc)
+      opt.prof = 1, folded = argv[++i];
+    else if (!strcmp(argv[i], "--gc-threads") && i + 1 < argc)
+      opt.gc_threads = strtoul(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "--gc-gen")) opt.gc_gen = 1;
+    else if (!strcmp(argv[i], "--gc-rc")) opt.gc_rc = 1;
+    else if (!strcmp(argv[i], "--memo")) opt.memo = 1;
+    else if (!strcmp(argv[i], "--memo-report")) opt.memo = memo_report_on = 1;
+    else if (!strcmp(argv[i], "--inline")) opt.inl = opt.strict = 1;
+    else if (!strcmp(argv[i], "--lazy")) opt.lazy = 1;
+    else if (!strcmp(argv[i], "--no-quicken")) opt.plain = 1;
+    else if (!strcmp(argv[i], "--strict")) opt.strict = 1;
+    else if (!strcmp(argv[i], "--parse-threads") && i + 1 < argc)
+      opt.parse_threads = strtoul(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "--eval-threads") && i + 1 < argc)
+      opt.eval_threads = strtoul(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "--gc-budget") && i + 1 < argc)
+      opt.gc_budget = strtoul(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "--mem-limit") && i + 1 < argc)
+      opt.mem_limit = strtoul(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "--serve") && i + 1 < argc)
+      sock = argv[++i], remote = 0;
+    else if (!strcmp(argv[i], "--client") && i + 1 < argc)
+      sock = argv[++i], remote = 1;
+    else if (!strcmp(argv[i], "--snapshot") && i + 1 < argc)
+      opt.snapshot = argv[++i];
+    else if (!strcmp(argv[i], "--save-snapshot") && i + 1 < argc)
+      opt.save = argv[++i], opt.strict = 1;
+    else if (!strcmp(argv[i], "--emit-c") && i + 1 < argc)
+      target = argv[++i], opt.strict = 1;
+    else if (!strcmp(argv[i], "--watch")) watching = opt.strict = 1;
+    else if (!strcmp(argv[i], "--workers") && i + 1 < argc)
+      workers = strtoul(argv[++i], NULL, 10);
+    else if (path == NULL) path = argv[i];
+    else return 1;
+  // inlining needs the callees resolved before the calls to them
+  if (opt.inl && opt.lazy)
+    fprintf(stderr, "warning: --inline resolves every body, --lazy is "
+            "ignored\n");
+  // a snapshot holds the tree of one run only, translations hold none
+  if (opt.snapshot != NULL && opt.save != NULL)
+    return conflict("--snapshot", "--save-snapshot");
+  if (opt.snapshot != NULL && target != NULL)
+    return conflict("--snapshot", "--emit-c");
+  // a server runs each script from fresh globals and keeps no files
+  if (sock != NULL && !remote) {
+    if (opt.snapshot != NULL) return conflict("--serve", "--snapshot");
+    if (opt.save != NULL) return conflict("--serve", "--save-snapshot");
+    if (target != NULL) return conflict("--serve", "--emit-c");
+    if (watching) return conflict("--serve", "--watch");
+  }
+  // watched forms come and go, nothing may hold on to the whole tree
+  if (watching) {
+    if (opt.snapshot != NULL) return conflict("--watch", "--snapshot");
+    if (opt.save != NULL) return conflict("--watch", "--save-snapshot");
+    if (target != NULL) return conflict("--watch", "--emit-c");
+    if (opt.memo) return conflict("--watch", "--memo");
+    if (opt.inl) return conflict("--watch", "--inline");
+  }
+  if (sock != NULL && !remote) return serve(sock, workers, finish);
+  if (path == NULL) return 1;
+  if (remote) return client(sock, path);
+  if (target != NULL) return emit_c(path, target);
+  if (watching) return watch(path, finish);
+  int ret = exec(path);
+  return finish() ? 1 : ret;
 }
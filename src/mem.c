@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "scan.h"
+#include "mem.h"
+
+// every block carries its size and category ahead of it, so that it is
+// accounted for when freed without the caller knowing either; counters
+// are atomic as parsing and collector threads allocate and free too
+
+typedef struct {
+  size_t size; // asked for
+  size_t cat;
+} head_t; // two words keep the alignment of malloc()
+
+static mem_stats_t mem;
+static int warned;
+
+static void *
+sys_alloc(void * ctx, size_t size) {
+  (void) ctx;
+  return malloc(size);
+}
+
+static void *
+sys_resize(void * ctx, void * ptr, size_t size) {
+  (void) ctx;
+  return realloc(ptr, size);
+}
+
+static void
+sys_release(void * ctx, void * ptr) {
+  (void) ctx;
+  free(ptr);
+}
+
+static const mem_ops_t sys = {sys_alloc, sys_resize, sys_release, NULL};
+
+static const mem_ops_t *
+ops(void) {
+  return opt.mem != NULL ? opt.mem : &sys;
+}
+
+// a racing update may lose a peak, never the counts
+static void
+lift(size_t * peak, size_t now) {
+  if (now > __atomic_load_n(peak, __ATOMIC_RELAXED))
+    __atomic_store_n(peak, now, __ATOMIC_RELAXED);
+}
+
+// takes size more bytes for cat, or refuses them past the limit
+static int
+take(size_t cat, size_t size) {
+  size_t now = __atomic_add_fetch(&mem.live, size, __ATOMIC_RELAXED);
+  if (opt.mem_limit && now > opt.mem_limit) {
+    __atomic_sub_fetch(&mem.live, size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&mem.refused, 1, __ATOMIC_RELAXED);
+    if (!__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED))
+      fprintf(stderr, "error: memory limit of %zu bytes exceeded\n",
+              opt.mem_limit);
+    return 1;
+  }
+  lift(&mem.top, now);
+  lift(&mem.peak[cat],
+        __atomic_add_fetch(&mem.bytes[cat], size, __ATOMIC_RELAXED));
+  return 0;
+}
+
+static void
+give(size_t cat, size_t size) {
+  __atomic_sub_fetch(&mem.live, size, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&mem.bytes[cat], size, __ATOMIC_RELAXED);
+}
+
+void *
+mem_alloc(int cat, size_t size) {
+  size_t c = (size_t) cat, full = sizeof(head_t) + size;
+  if (size > SIZE_MAX - sizeof(head_t) || take(c, full)) return NULL;
+  const mem_ops_t * o = ops();
+  head_t * head = o->alloc(o->ctx, full);
+  if (head == NULL) return give(c, full), NULL;
+  __atomic_add_fetch(&mem.made[c], 1, __ATOMIC_RELAXED);
+  return head->size = size, head->cat = c, head + 1;
+}
+
+void *
+mem_calloc(int cat, size_t n, size_t size) {
+  if (size && n > SIZE_MAX / size) return NULL;
+  void * ptr = mem_alloc(cat, n * size);
+  return ptr == NULL ? NULL : memset(ptr, 0, n * size);
+}
+
+// a block of ptr keeps its category, cat is that of a new one
+void *
+mem_realloc(int cat, void * ptr, size_t size) {
+  if (ptr == NULL) return mem_alloc(cat, size);
+  head_t * head = (head_t *) ptr - 1;
+  size_t c = head->cat, old = head->size;
+  if (size > SIZE_MAX - sizeof(head_t) ||
+      (size > old && take(c, size - old))) return NULL;
+  const mem_ops_t * o = ops();
+  head_t * h = o->resize(o->ctx, head, sizeof(head_t) + size);
+  if (h == NULL) {
+    if (size > old) give(c, size - old);
+    return NULL;
+  }
+  if (size < old) give(c, old - size);
+  __atomic_add_fetch(&mem.made[c], 1, __ATOMIC_RELAXED);
+  return h->size = size, h + 1;
+}
+
+void
+mem_free(void * ptr) {
+  if (ptr == NULL) return;
+  head_t * head = (head_t *) ptr - 1;
+  give(head->cat, sizeof(head_t) + head->size);
+  const mem_ops_t * o = ops();
+  o->release(o->ctx, head);
+}
+
+// peaks start over from what is live, for the next script
+void
+mem_reset(void) {
+  for (size_t i = 0; i < MEM_LEN; i++)
+    mem.peak[i] = mem.bytes[i], mem.made[i] = 0;
+  mem.top = mem.live, mem.refused = 0, warned = 0;
+}
+
+void
+mem_get(mem_stats_t * out) {
+  * out = mem;
+}
+
+void
+mem_dump(FILE * out) {
+  static const char * names[] = {
+    "ast", "map", "env", "gc", "vec", "memo", "snap"
+  };
+  for (size_t i = 0; i < MEM_LEN; i++)
+    fprintf(out, "  mem %-9s  %zu bytes peak, %zu allocs\n", names[i],
+            mem.peak[i], mem.made[i]);
+  fprintf(out, "  mem %-9s  %zu bytes peak, %zu refused\n", "total",
+          mem.top, mem.refused);
+}
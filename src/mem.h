@@ -0,0 +1,42 @@
+#ifndef MEM_H
+#define MEM_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define MEM_AST  0 // syntax nodes, parameter lists, parser stacks, line indexes
+#define MEM_MAP  1 // symbol maps and the scopes of deferred bodies
+#define MEM_ENV  2 // envs, their locals, closures and nursery chunks
+#define MEM_GC   3 // collector tables, worklists, marking and task threads
+#define MEM_VEC  4 // vectors
+#define MEM_MEMO 5 // memo tables and their analysis
+#define MEM_SNAP 6 // snapshot tables and the checkpoints of --watch
+#define MEM_LEN  7
+
+// where the memory of the interpreter comes from, set in opt.mem; the
+// functions are called from the parsing, marking and sweeping threads too
+typedef struct mem_ops {
+  void * (* alloc)(void * ctx, size_t size);
+  void * (* resize)(void * ctx, void * ptr, size_t size);
+  void   (* release)(void * ctx, void * ptr);
+  void *   ctx;
+} mem_ops_t;
+
+typedef struct {
+  size_t bytes[MEM_LEN];  // live, headers included
+  size_t peak[MEM_LEN];   // most bytes live at once since mem_reset()
+  size_t made[MEM_LEN];   // allocations since mem_reset()
+  size_t live;            // bytes over every category
+  size_t top;             // most of them at once
+  size_t refused;         // allocations past opt.mem_limit
+} mem_stats_t;
+
+void * mem_alloc(int cat, size_t size);
+void * mem_calloc(int cat, size_t n, size_t size);
+void * mem_realloc(int cat, void * ptr, size_t size);
+void mem_free(void * ptr);
+void mem_reset(void);
+void mem_get(mem_stats_t * out);
+void mem_dump(FILE * out);
+
+#endif
@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <string.h>
+#include "memo.h"
+#include "prof.h"
+#include "mem.h"
+
+typedef struct {
+  size_t sets;     // top-level defines of the global
+  int inner;       // defined from inside a function body too
+  node_t * value;
+} slot_t;
+
+typedef struct {
+  node_t * def;
+  size_t depth;    // scopes between the body and the globals
+} cand_t;
+
+typedef struct {
+  slot_t * slots;
+  cand_t * cands;
+  size_t len;
+  size_t capa;
+} walk_t;
+
+static memo_t * memos;
+
+// records the defines of globals and every def with its depth
+static int
+walk(walk_t * w, node_t * node, size_t depth) {
+  for (; node != NULL; node = node->next) {
+    if (node->type == NOD_SET) {
+      var_t * var = &node->front->next->val.v;
+      if (var->env == depth) {
+        slot_t * slot = &w->slots[var->off];
+        if (depth) slot->inner = 1;
+        else slot->sets++, slot->value = node->front->next->next;
+      }
+    } else if (node->type == NOD_DEF) {
+      if (w->len + 1 > w->capa) {
+        size_t request = w->capa ? w->capa * 2 : 64;
+        cand_t * cands = mem_realloc(MEM_MEMO, w->cands,
+                                     sizeof(* cands) * request);
+        if (cands == NULL) return 1;
+        w->cands = cands, w->capa = request;
+      }
+      w->cands[w->len++] = (cand_t) {.def = node, .depth = depth + 1};
+      if (walk(w, node->front, depth + 1)) return 1;
+      continue;
+    }
+    if (walk(w, node->front, depth)) return 1;
+  }
+  return 0;
+}
+
+// a global defined once at the top level to a literal or a memoized
+// function always reads the same, or nil before its define runs
+static int
+constant(walk_t * w, size_t off) {
+  slot_t * slot = &w->slots[off];
+  if (slot->sets != 1 || slot->inner) return 0;
+  node_t * value = slot->value;
+  return value->type == NOD_INT || value->type == NOD_BOL ||
+         (value->type == NOD_DEF && value->val.d.memo != NULL);
+}
+
+// whether the nodes read nothing but locals and constant globals
+static int
+closed(walk_t * w, node_t * node, size_t depth) {
+  for (; node != NULL; node = node->next)
+    if (node->type == NOD_DEF) {
+      return 0;
+    } else if (node->type == NOD_VAR) {
+      var_t * var = &node->val.v;
+      if (var->env && (var->env != depth || !constant(w, var->off)))
+        return 0;
+    } else if (!closed(w, node->front, depth)) {
+      return 0;
+    }
+  return 1;
+}
+
+// gives a memo table to every pure def whose result depends on its
+// arguments alone, starting from all candidates and dropping those that
+// read a global that turns out not to be constant
+int
+memo_analyze(node_t * root, size_t globals, const char * file) {
+  walk_t w = {mem_calloc(MEM_MEMO, globals + 1, sizeof(slot_t)),
+              NULL, 0, 0};
+  int err = 0;
+  if (w.slots == NULL) return 1;
+  if (walk(&w, root->front, 0))
+    return mem_free(w.slots), mem_free(w.cands), 1;
+  for (size_t i = 0; i < w.len; i++) {
+    def_t * def = &w.cands[i].def->val.d;
+    if (!def->pure || def->scope != NULL || def->len > MEMO_ARGS) continue;
+    if ((def->memo = mem_calloc(MEM_MEMO, 1, sizeof(memo_t))) == NULL) {
+      err = 1;
+      break;
+    }
+    def->memo->len = def->len;
+  }
+  for (int changed = 1; changed;) {
+    changed = 0;
+    for (size_t i = 0; i < w.len; i++) {
+      node_t * node = w.cands[i].def;
+      def_t * def = &node->val.d;
+      if (def->memo == NULL ||
+          closed(&w, node->front->next->next, w.cands[i].depth)) continue;
+      mem_free(def->memo), def->memo = NULL, changed = 1;
+    }
+  }
+  // linked backwards, so the report lists functions in source order, or
+  // all dropped if one could not be had
+  for (size_t i = w.len; i--;) {
+    node_t * node = w.cands[i].def;
+    memo_t * memo = node->val.d.memo;
+    if (memo == NULL) continue;
+    if (err || (memo->name = prof_name(node, file)) == NULL)
+      mem_free(memo), memo = node->val.d.memo = NULL;
+    else
+      memo->link = memos, memos = memo;
+  }
+  return mem_free(w.slots), mem_free(w.cands), err;
+}
+
+// the slot of key, 0 when an argument is neither an integer nor a boolean
+static int
+slot(memo_t * memo, const obj_t * key, size_t * at) {
+  size_t h = 2166136261u;
+  for (size_t i = 0; i < memo->len; i++) {
+    if (obj_type(key[i]) != OBJ_INT && obj_type(key[i]) != OBJ_BOL) return 0;
+    h = (h ^ (size_t) (key[i] >> 32)) * 16777619u;
+    h = (h ^ (size_t) obj_type(key[i])) * 16777619u;
+  }
+  return * at = (h ^ h >> 15) & (MEMO_SLOTS - 1), 1;
+}
+
+int
+memo_get(memo_t * memo, const obj_t * key, obj_t * obj) {
+  size_t at;
+  if (!slot(memo, key, &at)) return 0;
+  if (memo->vals != NULL && memo->vals[at] != OBJ_NIL) {
+    const obj_t * row = &memo->keys[at * memo->len];
+    size_t i = 0;
+    for (; i < memo->len; i++)
+      if (row[i] != key[i]) break;
+    if (i == memo->len) return * obj = memo->vals[at], memo->hits++, 1;
+  }
+  return memo->misses++, 0;
+}
+
+// 1 if the table could not be had
+int
+memo_put(memo_t * memo, const obj_t * key, const obj_t * obj) {
+  size_t at;
+  if (obj_type(* obj) != OBJ_INT && obj_type(* obj) != OBJ_BOL) return 0;
+  if (!slot(memo, key, &at)) return 0;
+  if (memo->vals == NULL) {
+    memo->vals = mem_calloc(MEM_MEMO, MEMO_SLOTS, sizeof(* memo->vals));
+    memo->keys = mem_alloc(MEM_MEMO,
+                           sizeof(* memo->keys) * MEMO_SLOTS * memo->len + 1);
+    if (memo->vals == NULL || memo->keys == NULL) {
+      mem_free(memo->vals), mem_free(memo->keys);
+      memo->vals = memo->keys = NULL;
+      return 1;
+    }
+  }
+  if (memo->vals[at] != OBJ_NIL) memo->evictions++;
+  memcpy(&memo->keys[at * memo->len], key, sizeof(* key) * memo->len);
+  return memo->vals[at] = * obj, 0;
+}
+
+void
+memo_report(FILE * out) {
+  fprintf(out, "--- memo ---\n");
+  fprintf(out, "%12s %12s %12s  %s\n", "hits", "misses", "evictions", "name");
+  for (memo_t * memo = memos; memo != NULL; memo = memo->link)
+    fprintf(out, "%12zu %12zu %12zu  %s\n",
+            memo->hits, memo->misses, memo->evictions, memo->name);
+  fprintf(out, "------------\n");
+}
+
+void
+memo_free(void) {
+  while (memos != NULL) {
+    memo_t * memo = memos;
+    memos = memo->link;
+    mem_free(memo->keys), mem_free(memo->vals), free(memo->name);
+    mem_free(memo);
+  }
+}
@@ -0,0 +1,27 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <stdio.h>
+#include "scan.h"
+
+#define MEMO_SLOTS 4096 // entries per function, colliding keys evict
+#define MEMO_ARGS  8    // functions with more parameters are not memoized
+
+typedef struct memo {
+  struct memo * link; // every table, for the report
+  char * name;
+  size_t len;         // parameters
+  size_t hits;
+  size_t misses;
+  size_t evictions;
+  obj_t * keys;       // MEMO_SLOTS rows of len arguments
+  obj_t * vals;       // OBJ_NIL marks an empty slot
+} memo_t;
+
+int memo_analyze(node_t * root, size_t globals, const char * file);
+int memo_get(memo_t * memo, const obj_t * key, obj_t * obj);
+int memo_put(memo_t * memo, const obj_t * key, const obj_t * obj);
+void memo_report(FILE * out);
+void memo_free(void);
+
+#endif
@@ -0,0 +1,251 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "scan.h"
+#include "mem.h"
+
+#define PAR_STACK (256 << 20) // worker stack when the limit is unlimited
+
+typedef struct {
+  node_t * node;
+  env_t * prev;
+  int * cancel;
+  obj_t obj;
+  int err;
+  int queued; // touched by the caller only
+  int done;   // under the pool lock
+} task_t;
+
+typedef struct {
+  task_t ** items;
+  size_t capa;
+  size_t top;    // thieves take from here
+  size_t bottom;
+  pthread_mutex_t lock;
+} deque_t;
+
+typedef struct {
+  struct par_pool * pool;
+  size_t id;
+} worker_t;
+
+struct par_pool {
+  size_t      len;     // deques, one per worker
+  deque_t *   deques;
+  worker_t *  workers;
+  pthread_t * threads;
+  size_t      started;
+  size_t      queued;  // tasks in the deques
+  size_t      next;    // deque the next task is pushed to
+  int         quit;
+  pthread_mutex_t lock;
+  pthread_cond_t  work;
+  pthread_cond_t  done;
+};
+
+static int
+deque_push(deque_t * deque, task_t * task) {
+  pthread_mutex_lock(&deque->lock);
+  if (deque->bottom == deque->capa) {
+    size_t len = deque->bottom - deque->top;
+    if (deque->top) {
+      for (size_t i = 0; i < len; i++)
+        deque->items[i] = deque->items[deque->top + i];
+    } else {
+      size_t request = deque->capa ? deque->capa * 2 : 8;
+      task_t ** items = mem_realloc(MEM_GC, deque->items,
+                                    sizeof(* items) * request);
+      if (items == NULL) return pthread_mutex_unlock(&deque->lock), 1;
+      deque->items = items, deque->capa = request;
+    }
+    deque->top = 0, deque->bottom = len;
+  }
+  deque->items[deque->bottom++] = task;
+  return pthread_mutex_unlock(&deque->lock), 0;
+}
+
+// tasks are taken oldest first, the caller needs the leftmost argument first
+static task_t *
+deque_take(deque_t * deque) {
+  task_t * task = NULL;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->top < deque->bottom) task = deque->items[deque->top++];
+  pthread_mutex_unlock(&deque->lock);
+  return task;
+}
+
+// takes a task from deque id, or steals one from the others
+static task_t *
+take(struct par_pool * pool, size_t id) {
+  for (size_t i = 0; i < pool->len; i++) {
+    task_t * task = deque_take(&pool->deques[(id + i) % pool->len]);
+    if (task != NULL) {
+      pthread_mutex_lock(&pool->lock);
+      pool->queued--;
+      pthread_mutex_unlock(&pool->lock);
+      return task;
+    }
+  }
+  return NULL;
+}
+
+// evaluates the argument on a private heap, the task gives up instead of
+// printing or calling an impure function, and reports nothing
+static void
+task_run(struct par_pool * pool, task_t * task) {
+  gc_t * gc = gc_plain();
+  int err = 1;
+  if (gc != NULL) {
+    gc->task = 1, gc->cancel = task->cancel;
+    err = eval(task->node, task->prev, NULL, gc, NULL, &task->obj);
+    gc_free(gc);
+  }
+  pthread_mutex_lock(&pool->lock);
+  task->err = err, task->done = 1;
+  pthread_cond_broadcast(&pool->done);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static void *
+work(void * arg) {
+  worker_t * worker = arg;
+  struct par_pool * pool = worker->pool;
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->quit && !pool->queued)
+      pthread_cond_wait(&pool->work, &pool->lock);
+    int quit = pool->quit;
+    pthread_mutex_unlock(&pool->lock);
+    if (quit) return NULL;
+    task_t * task = take(pool, worker->id);
+    if (task != NULL) task_run(pool, task);
+  }
+}
+
+struct par_pool *
+par_pool_new(size_t threads) {
+  struct par_pool * pool = mem_calloc(MEM_GC, 1, sizeof(* pool));
+  if (pool == NULL) return NULL;
+  // the caller evaluates arguments too
+  pool->len = threads - 1;
+  pool->deques = mem_calloc(MEM_GC, pool->len, sizeof(* pool->deques));
+  pool->workers = mem_calloc(MEM_GC, pool->len, sizeof(* pool->workers));
+  pool->threads = mem_calloc(MEM_GC, pool->len, sizeof(* pool->threads));
+  if (pool->deques == NULL || pool->workers == NULL || pool->threads == NULL)
+    return par_pool_free(pool), NULL;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  for (size_t i = 0; i < pool->len; i++) {
+    pthread_mutex_init(&pool->deques[i].lock, NULL);
+    pool->workers[i] = (worker_t) {.pool = pool, .id = i};
+  }
+  // tasks recurse as deep as the main thread may
+  struct rlimit limit;
+  size_t stack = PAR_STACK;
+  if (!getrlimit(RLIMIT_STACK, &limit) && limit.rlim_cur != RLIM_INFINITY)
+    stack = (size_t) limit.rlim_cur;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, stack);
+  for (; pool->started < pool->len; pool->started++)
+    if (pthread_create(&pool->threads[pool->started], &attr, work,
+                       &pool->workers[pool->started])) break;
+  pthread_attr_destroy(&attr);
+  if (!pool->started) return par_pool_free(pool), NULL;
+  return pool;
+}
+
+void
+par_pool_free(struct par_pool * pool) {
+  if (pool->started) {
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < pool->started; i++)
+      pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+  }
+  for (size_t i = 0; pool->deques != NULL && i < pool->len; i++) {
+    mem_free(pool->deques[i].items);
+    if (pool->started) pthread_mutex_destroy(&pool->deques[i].lock);
+  }
+  mem_free(pool->deques), mem_free(pool->workers);
+  mem_free(pool->threads);
+  mem_free(pool);
+}
+
+// helps with the queued tasks until task is done
+static void
+await(struct par_pool * pool, task_t * task) {
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    int done = task->done;
+    pthread_mutex_unlock(&pool->lock);
+    if (done) return;
+    task_t * next = take(pool, 0);
+    if (next != NULL) { task_run(pool, next); continue; }
+    pthread_mutex_lock(&pool->lock);
+    while (!task->done) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    return;
+  }
+}
+
+// cancels the tasks of a call and waits for those still queued or running,
+// which hold pointers into tasks and read the shared heap
+static void
+settle(struct par_pool * pool, task_t * tasks, size_t len, int * cancel) {
+  __atomic_store_n(cancel, 1, __ATOMIC_RELAXED);
+  for (size_t i = 0; i < len; i++)
+    if (tasks[i].queued) await(pool, &tasks[i]);
+}
+
+// evaluates the arguments of parent into env, the calls among them as tasks;
+// results are taken in order and an argument whose task failed, or returned
+// a closure or vector of its private heap, is evaluated again on the caller,
+// along with every argument after it, so output, effects and the first error
+// are those of sequential evaluation
+int
+par_args(node_t * parent, env_t * prev, env_t * env, def_t * def,
+         gc_t * gc, const char * file) {
+  struct par_pool * pool = gc->par;
+  task_t * tasks = mem_calloc(MEM_GC, def->len, sizeof(* tasks));
+  if (tasks == NULL) return 1;
+  node_t * arg = parent->front->next;
+  size_t queued = 0;
+  int cancel = 0;
+  for (size_t i = 0; i < def->len; i++, arg = arg->next) {
+    tasks[i].node = arg, tasks[i].prev = prev, tasks[i].cancel = &cancel;
+    if (arg->type != NOD_FUN) continue;
+    deque_t * deque = &pool->deques[pool->next++ % pool->len];
+    if (deque_push(deque, &tasks[i])) continue;
+    tasks[i].queued = 1, queued++;
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->queued += queued;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+  int err = 0, serial = 0;
+  for (size_t i = 0; i < def->len; i++) {
+    task_t * task = &tasks[i];
+    int again = !task->queued || serial;
+    if (!again) {
+      await(pool, task);
+      again = task->err || obj_type(task->obj) == OBJ_FUN ||
+              obj_type(task->obj) == OBJ_VEC;
+      // the later tasks may have read what this evaluation changes
+      if (again) serial = 1, settle(pool, tasks, def->len, &cancel);
+    }
+    obj_t ret = task->obj;
+    if (again && eval(task->node, prev, env, gc, file, &ret)) { err = 1; break; }
+    var_t var = {.env = 0, .off = def->args[i]};
+    if (env_set(env, &var, &ret, gc)) { err = 1; break; }
+  }
+  settle(pool, tasks, def->len, &cancel);
+  return mem_free(tasks), err;
+}
@@ -0,0 +1,118 @@
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include "pmu.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+static const char * names[] = {
+  "cycles", "instrs", "br-miss", "l1d-miss", "llc-miss"
+};
+
+const char *
+pmu_name(int i) {
+  return names[i];
+}
+
+#ifdef __linux__
+
+static const struct {
+  uint32_t type;
+  uint64_t config;
+} events[] = {
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+  {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+   PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES}
+};
+
+static int state;          // 0 before the first read, 1 open, -1 unavailable
+static int lead;           // the first counter opened, the others follow it
+static int slots[PMU_LEN]; // place of each counter in a read, -1 if missing
+static int err;            // why the first counter failed to open
+
+// counts user space only, which perf_event_paranoid 2 still allows
+static int
+open_event(int i, int group) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = events[i].type, attr.config = events[i].config;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.exclude_kernel = 1, attr.exclude_hv = 1;
+  return (int) syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+// one group, so that a read is a single call and the counts agree
+static void
+start(void) {
+  int len = 0;
+  lead = -1;
+  for (int i = 0; i < PMU_LEN; i++) {
+    int fd = open_event(i, lead);
+    slots[i] = fd == -1 ? -1 : len++;
+    if (fd == -1 && !err) err = errno;
+    if (fd != -1 && lead == -1) lead = fd;
+  }
+  state = lead == -1 ? -1 : 1;
+}
+
+// the counts since the first read, scaled up when the kernel had to share
+// the counters with other groups; 1 if there are none
+int
+pmu_read(size_t * out) {
+  if (state == 0) start();
+  if (state < 0) return 1;
+  uint64_t buf[3 + PMU_LEN];
+  if (read(lead, buf, sizeof(buf)) < (ssize_t) (sizeof(* buf) * 4)) return 1;
+  uint64_t enabled = buf[1], running = buf[2];
+  for (int i = 0; i < PMU_LEN; i++) {
+    uint64_t n = slots[i] == -1 || !running ? 0 : buf[3 + slots[i]];
+    if (running && running < enabled)
+      n = (uint64_t) ((double) n * (double) enabled / (double) running);
+    out[i] = (size_t) n;
+  }
+  return 0;
+}
+
+int
+pmu_has(int i) {
+  if (state == 0) start();
+  return state > 0 && slots[i] != -1;
+}
+
+// why there are no counters, NULL if there are
+const char *
+pmu_error(void) {
+  if (state == 0) start();
+  return state > 0 ? NULL : strerror(err);
+}
+
+#else
+
+int
+pmu_read(size_t * out) {
+  (void) out;
+  return 1;
+}
+
+int
+pmu_has(int i) {
+  (void) i;
+  return 0;
+}
+
+const char *
+pmu_error(void) {
+  return "not supported on this system";
+}
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef PMU_H
+#define PMU_H
+
+#include <stddef.h>
+
+#define PMU_CYCLES 0 // cpu cycles
+#define PMU_INSTRS 1 // instructions retired
+#define PMU_BRANCH 2 // mispredicted branches
+#define PMU_L1D    3 // level 1 data cache read misses
+#define PMU_LLC    4 // last level cache misses
+#define PMU_LEN    5
+
+// hardware event counters of the calling thread, through perf_event_open()
+// on linux; the first read opens them, counters the kernel or the machine
+// does not offer stay unavailable and read as zero
+
+const char * pmu_name(int i);
+int pmu_read(size_t * out);
+int pmu_has(int i);
+const char * pmu_error(void);
+
+#endif
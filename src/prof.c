@@ -0,0 +1,173 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include "prof.h"
+#include "stats.h"
+
+typedef struct {
+  prof_ctx_t * ctx;
+  double begin;
+  double child; // time spent in callees
+} frame_t;
+
+static prof_rec_t ** recs; // open addressing, keyed by def
+static size_t recs_capa, recs_len;
+static frame_t * frames;
+static size_t frames_capa, frames_len;
+static prof_ctx_t root, * ctxs; // ctxs links every allocated context
+
+static size_t
+hash(node_t * def, size_t capa) {
+  return ((size_t) def >> 4) * 2654435761u & (capa - 1);
+}
+
+// the name the function was defined under, or its definition site
+char *
+prof_name(node_t * def, const char * file) {
+  node_t * parent = def->parent;
+  char * name;
+  int len;
+  if (parent != NULL && parent->type == NOD_SET &&
+      parent->front->next->next == def) {
+    tok_t * tok = &parent->front->next->tok;
+    len = (int) tok->len;
+    if ((name = malloc((size_t) len + 1)) == NULL) return NULL;
+    sprintf(name, "%.*s", len, tok->begin);
+  } else {
+    const char * at = def->tok.begin, * src, * line;
+    size_t lnum;
+    if (lines_find(at, &src, &line, &lnum) == 0 && src != NULL) file = src;
+    size_t col = (size_t) (at - line + 1);
+    len = snprintf(NULL, 0, "fun@%s:%zu:%zu", file, lnum + 1, col);
+    if ((name = malloc((size_t) len + 1)) == NULL) return NULL;
+    sprintf(name, "fun@%s:%zu:%zu", file, lnum + 1, col);
+  }
+  return name;
+}
+
+static prof_rec_t *
+rec_get(node_t * def, const char * file) {
+  if (recs_capa) {
+    for (size_t i = hash(def, recs_capa);; i = (i + 1) & (recs_capa - 1))
+      if (recs[i] == NULL) break;
+      else if (recs[i]->def == def) return recs[i];
+  }
+  if ((recs_len + 1) * 2 > recs_capa) {
+    size_t capa = recs_capa ? recs_capa * 2 : 64;
+    prof_rec_t ** ptr = calloc(capa, sizeof(* ptr));
+    if (ptr == NULL) return NULL;
+    for (size_t j = 0; j < recs_capa; j++) {
+      if (recs[j] == NULL) continue;
+      size_t i = hash(recs[j]->def, capa);
+      while (ptr[i] != NULL) i = (i + 1) & (capa - 1);
+      ptr[i] = recs[j];
+    }
+    free(recs), recs = ptr, recs_capa = capa;
+  }
+  prof_rec_t * rec = calloc(1, sizeof(* rec));
+  if (rec == NULL) return NULL;
+  if ((rec->name = prof_name(def, file)) == NULL) return free(rec), NULL;
+  rec->def = def;
+  size_t i = hash(def, recs_capa);
+  while (recs[i] != NULL) i = (i + 1) & (recs_capa - 1);
+  return recs[i] = rec, recs_len++, rec;
+}
+
+static prof_ctx_t *
+ctx_get(prof_ctx_t * parent, prof_rec_t * rec) {
+  for (prof_ctx_t * ctx = parent->front; ctx != NULL; ctx = ctx->next)
+    if (ctx->rec == rec) return ctx;
+  prof_ctx_t * ctx = calloc(1, sizeof(* ctx));
+  if (ctx == NULL) return NULL;
+  ctx->parent = parent, ctx->rec = rec;
+  ctx->next = parent->front, parent->front = ctx;
+  ctx->link = ctxs, ctxs = ctx;
+  return ctx;
+}
+
+// 1 if out of memory, the call then goes unprofiled and must not leave
+int
+prof_enter(node_t * def, const char * file) {
+  if (frames_len + 1 > frames_capa) {
+    size_t capa = frames_capa ? frames_capa * 2 : 64;
+    frame_t * ptr = realloc(frames, sizeof(* ptr) * capa);
+    if (ptr == NULL) return 1;
+    frames = ptr, frames_capa = capa;
+  }
+  prof_ctx_t * parent = frames_len ? frames[frames_len - 1].ctx : &root;
+  prof_rec_t * rec = rec_get(def, file);
+  prof_ctx_t * ctx = rec == NULL ? NULL : ctx_get(parent, rec);
+  if (ctx == NULL) return 1;
+  rec->calls++, rec->depth++;
+  frames[frames_len++] = (frame_t) {.ctx = ctx, .begin = stats_now()};
+  return 0;
+}
+
+void
+prof_leave(void) {
+  if (!frames_len) return;
+  frame_t * frame = &frames[--frames_len];
+  prof_rec_t * rec = frame->ctx->rec;
+  double total = stats_now() - frame->begin, self = total - frame->child;
+  frame->ctx->self += self, rec->self += self;
+  if (!--rec->depth) rec->incl += total;
+  if (frames_len) frames[frames_len - 1].child += total;
+}
+
+static int
+reccmp(const void * a, const void * b) {
+  const prof_rec_t * x = * (prof_rec_t * const *) a;
+  const prof_rec_t * y = * (prof_rec_t * const *) b;
+  return (x->self < y->self) - (x->self > y->self);
+}
+
+void
+prof_report(FILE * out) {
+  prof_rec_t ** sorted = malloc(sizeof(* sorted) * (recs_len + 1));
+  if (sorted == NULL) return;
+  size_t len = 0;
+  for (size_t i = 0; i < recs_capa; i++)
+    if (recs[i] != NULL) sorted[len++] = recs[i];
+  qsort(sorted, len, sizeof(* sorted), reccmp);
+  fprintf(out, "--- profile ---\n");
+  fprintf(out, "%12s %12s %12s  %s\n", "calls", "self ms", "incl ms", "name");
+  for (size_t i = 0; i < len; i++) {
+    prof_rec_t * rec = sorted[i];
+    fprintf(out, "%12zu %12.3f %12.3f  %s\n", rec->calls,
+            rec->self * 1e3, rec->incl * 1e3, rec->name);
+  }
+  fprintf(out, "---------------\n");
+  free(sorted);
+}
+
+static void
+ctx_path(prof_ctx_t * ctx, FILE * out) {
+  if (ctx->parent != &root) ctx_path(ctx->parent, out), fprintf(out, ";");
+  fputs(ctx->rec->name, out);
+}
+
+// one line per calling context: "a;b;c <self microseconds>"
+void
+prof_folded(FILE * out) {
+  prof_ctx_t * ctx = root.front;
+  while (ctx != NULL) {
+    unsigned long us = (unsigned long) (ctx->self * 1e6 + 0.5);
+    if (us) ctx_path(ctx, out), fprintf(out, " %lu\n", us);
+    if (ctx->front != NULL) { ctx = ctx->front; continue; }
+    while (ctx != &root && ctx->next == NULL) ctx = ctx->parent;
+    ctx = ctx == &root ? NULL : ctx->next;
+  }
+}
+
+void
+prof_free(void) {
+  while (ctxs != NULL) {
+    prof_ctx_t * ctx = ctxs;
+    ctxs = ctx->link, free(ctx);
+  }
+  root.front = NULL;
+  for (size_t i = 0; i < recs_capa; i++)
+    if (recs[i] != NULL) free(recs[i]->name), free(recs[i]);
+  free(recs), recs = NULL, recs_capa = recs_len = 0;
+  free(frames), frames = NULL, frames_capa = frames_len = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdio.h>
+#include "scan.h"
+
+typedef struct {
+  node_t * def;   // the NOD_DEF being profiled, only valid while running
+  char * name;
+  size_t calls;
+  size_t depth;   // active activations, for recursive inclusive time
+  double incl;    // seconds, outermost activations only
+  double self;    // seconds
+} prof_rec_t;
+
+typedef struct ctx {
+  struct ctx * parent;
+  struct ctx * front; // first callee
+  struct ctx * next;  // sibling
+  struct ctx * link;  // allocation list
+  prof_rec_t * rec;
+  double self;
+} prof_ctx_t; // calling context
+
+char * prof_name(node_t * def, const char * file);
+int prof_enter(node_t * def, const char * file);
+void prof_leave(void);
+void prof_report(FILE * out);
+void prof_folded(FILE * out);
+void prof_free(void);
+
+#endif
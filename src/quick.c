@@ -0,0 +1,72 @@
+#include <limits.h>
+#include "scan.h"
+#include "stats.h"
+
+static int
+arith(int type) {
+  return type == NOD_ADD || type == NOD_SUB || type == NOD_MUL;
+}
+
+static int
+compare(int type) {
+  return type == NOD_LT || type == NOD_GT || type == NOD_EQ;
+}
+
+// decodes an operand that needs no eval, 1 if node is anything else
+static int
+operand(node_t * node, opnd_t * o) {
+  if (node->type == NOD_VAR) return o->v = node->val.v, o->var = 1, 0;
+  if (node->type == NOD_INT) return o->i = node->val.i, o->var = 0, 0;
+  return 1;
+}
+
+// rewrites the binary operations on variables and integer literals, and the
+// ifs that test one, into nodes that read their operands in place; the
+// operands stay in the tree for the general path. Bodies still waiting for
+// resolve() are left to it
+void
+quicken(node_t * node) {
+  for (; node != NULL; node = node->next) {
+    if (node->type == NOD_DEF && node->val.d.scope != NULL) continue;
+    quicken(node->front);
+    node_t * a = node->front != NULL ? node->front->next : NULL;
+    if (arith(node->type) || compare(node->type)) {
+      quick_t q;
+      if (a->next == NULL || a->next->next != NULL ||
+          operand(a, &q.a) || operand(a->next, &q.b)) continue;
+      q.op = node->type, node->val.q = q, node->type = NOD_QOP;
+      STATS(stats.nodes_quick++);
+    } else if (node->type == NOD_IF &&
+               a->type == NOD_QOP && compare(a->val.q.op)) {
+      node->type = NOD_QIF;
+      STATS(stats.nodes_quick++);
+    }
+  }
+}
+
+static int
+load(opnd_t * o, env_t * env, int * ret) {
+  if (!o->var) return * ret = o->i, 0;
+  for (size_t i = 0; i < o->v.env; i++) env = env->prev;
+  obj_t obj = env->locs[o->v.off].obj;
+  if (obj_type(obj) != OBJ_INT) return 1;
+  return * ret = obj_i(obj), 0;
+}
+
+// evaluates a quickened operation in env, 1 leaves operands that are not
+// integers and results that overflow to the general path, which reports them
+int
+quick_eval(node_t * node, env_t * env, obj_t * obj) {
+  quick_t * q = &node->val.q;
+  int a, b;
+  if (load(&q->a, env, &a) || load(&q->b, env, &b)) return 1;
+  long long c;
+  if (q->op == NOD_LT) return * obj = mkbol(a < b), 0;
+  else if (q->op == NOD_GT) return * obj = mkbol(a > b), 0;
+  else if (q->op == NOD_EQ) return * obj = mkbol(a == b), 0;
+  else if (q->op == NOD_ADD) c = (long long) a + b;
+  else if (q->op == NOD_SUB) c = (long long) a - b;
+  else c = (long long) a * b;
+  if (c < INT_MIN || c > INT_MAX) return 1;
+  return * obj = mkint((int) c), 0;
+}
@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "rt.h"
+#include "stats.h"
+#include "mem.h"
+
+// what the interpreter and translated programs share: frames, the heap
+// around the collector, diagnostics and the checked integer operations
+
+opt_t opt;
+
+// sources nobody registered leave the position out
+void
+error_begin(const char * str, const char * file) {
+  const char * name, * line;
+  size_t lnum;
+  if (lines_find(str, &name, &line, &lnum))
+    fprintf(stderr, "%s: error: ", file);
+  else
+    fprintf(stderr, "%s:%zu:%zu: error: ", name != NULL ? name : file,
+            lnum + 1, (size_t) (str - line + 1));
+}
+
+void
+error_end(const char * str) {
+  const char * name, * line;
+  size_t lnum;
+  lines_find(str, &name, &line, &lnum);
+  const char * end = line;
+  while (* end && * end != '\n') end++;
+  fprintf(stderr, "%.*s\n", (int) (end - line), line);
+  for (const char * ptr = line; ptr < str; ptr++) fprintf(stderr, " ");
+  fprintf(stderr, "^-----\n");
+}
+
+env_t *
+env_new(env_t * prev, env_t * ret, size_t len) {
+  env_t * env = mem_alloc(MEM_ENV, sizeof(* env));
+  if (env == NULL) return NULL;
+  loc_t * locs = mem_alloc(MEM_ENV, sizeof(* env->locs) * len);
+  if (locs == NULL) return mem_free(env), NULL;
+  for (size_t i = 0; i < len; i++) {
+    locs[i].obj = OBJ_NIL;
+  }
+  env->ret = ret;
+  env->prev = prev;
+  env->locs = locs;
+  env->len = len;
+  env->chunk = NULL;
+  env->rem = 0;
+  env->refs = 1;
+  env->funs = NULL;
+  // only counted for --gc-rc, parallel tasks must not write shared envs
+  if (prev != NULL && opt.gc_rc) prev->refs++;
+  STATS(
+    size_t live = ++stats.envs_new - stats.envs_free;
+    if (live > stats.envs_peak) stats.envs_peak = live);
+  return env;
+}
+
+void
+env_release(env_t * env) {
+  while (env->funs != NULL) {
+    fun_t * fun = env->funs;
+    env->funs = fun->next, mem_free(fun);
+  }
+  if (env->chunk != NULL) { gc_chunk_release(env->chunk); return; }
+  mem_free(env->locs);
+  mem_free(env);
+}
+
+void
+env_free(env_t * env) {
+  env_release(env);
+  STATS(stats.envs_free++);
+}
+
+int
+env_add(env_t * env, size_t len) {
+  if (len <= env->len) return 0;
+  loc_t * locs = mem_realloc(MEM_ENV, env->locs, sizeof(* locs) * len);
+  if (locs == NULL) return 1;
+  for (size_t i = env->len; i < len; i++) {
+    locs[i].obj = OBJ_NIL;
+  }
+  env->locs = locs;
+  env->len = len;
+  return 0;
+}
+
+void
+env_dump(env_t * env, int ret);
+
+void
+env_get(env_t * env, var_t * var, obj_t * obj) {
+  for (size_t i = 0; i < var->env; i++) env = env->prev;
+  * obj = env->locs[var->off].obj;
+}
+
+int
+env_set(env_t * env, var_t * var, obj_t * obj, gc_t * gc) {
+  for (size_t i = 0; i < var->env; i++) env = env->prev;
+  if (gc_shade(gc, env, obj)) return 1;
+  obj_t old = env->locs[var->off].obj;
+  env->locs[var->off].obj = * obj;
+  if (gc->rc) {
+    if (obj_type(* obj) == OBJ_FUN) obj_f(* obj)->env->refs++;
+    if (obj_type(old) == OBJ_FUN && gc_unref(gc, obj_f(old)->env, NULL))
+      return 1;
+  }
+  return 0;
+}
+
+void
+env_dump(env_t * env, int ret) {
+  for (size_t i = 0; env != NULL; env = ret ? env->ret : env->prev, i++) {
+    printf("--- scope %zu --- %p\n", i, (void *) env);
+    printf("  variables size: %zu\n", env->len);
+  }
+  printf("---------------\n");
+}
+
+// a stop-the-world heap that collects on every allocation
+gc_t *
+gc_plain(void) {
+  gc_t * gc = mem_alloc(MEM_GC, sizeof(* gc));
+  if (gc == NULL) return NULL;
+  gc->addrs = NULL;
+  gc->capa = gc->len = 0;
+  gc->work = NULL;
+  gc->wlen = gc->wcapa = 0;
+  gc->phase = GC_IDLE, gc->next = GC_MIN;
+  gc->old = gc->rlen = gc->rcapa = 0;
+  gc->rem = NULL;
+  gc->nursery = NULL, gc->pool = NULL, gc->par = NULL;
+  gc->rc = 0, gc->budget = 0, gc->task = 0, gc->cancel = NULL;
+  gc->vecs = gc->vroots = NULL;
+  gc->vlen = gc->vcapa = gc->vrlen = gc->vrcapa = 0;
+  gc->vbytes = 0, gc->vnext = GC_VEC_MIN;
+  return gc;
+}
+
+// the heap the collector options ask for
+gc_t *
+gc_heap(void) {
+  gc_t * gc = gc_plain();
+  if (gc == NULL) return NULL;
+  gc->rc = opt.gc_rc && !opt.gc_gen;
+  gc->budget = opt.gc_budget;
+  // nursery chunks are released on the mutator, so no background sweeper
+  if (opt.gc_gen) {
+    if ((gc->nursery = gc_nursery_new()) == NULL) return mem_free(gc), NULL;
+  } else if (opt.gc_threads > 1) {
+    gc->pool = gc_pool_new(gc, opt.gc_threads);
+  }
+  return gc;
+}
+
+int
+gc_overflow(gc_t * gc) {
+  //printf("gc: %zu\n", gc->len);
+  return gc->len > 0;
+}
+
+int gc_step(gc_t * gc, env_t * env);
+
+int
+gc_add(gc_t * gc, env_t * env, size_t * id) {
+  if (gc->nursery != NULL) {
+    if (gc->old >= gc->next || gc->vbytes >= gc->vnext) {
+      // the old generation doubled, collect everything
+      for (size_t i = 0; i < gc->rlen; i++) gc->rem[i]->rem = 0;
+      gc->rlen = 0;
+      if (gc_cleanup(gc, env->prev, env->ret)) return 1;
+      gc->old = gc->len, gc->next = gc->len * 2 > GC_MIN ? gc->len * 2 : GC_MIN;
+    } else if (gc->len - gc->old >= GC_YOUNG) {
+      if (gc_minor(gc, env->prev, env->ret)) return 1;
+    }
+  } else if (gc->rc) {
+    // most envs are freed by gc_unref(), tracing only finds cycles
+    if (gc->len >= gc->next || gc->vbytes >= gc->vnext) {
+      if (gc_cleanup(gc, env->prev, env->ret)) return 1;
+      gc->next = gc->len * 2 > GC_MIN ? gc->len * 2 : GC_MIN;
+    }
+  } else if (gc->budget) {
+    if (gc_step(gc, env)) return 1;
+  } else if (gc->pool != NULL) {
+    // waking the markers is worth it once the heap doubled, not per env
+    if (gc->len >= gc->next || gc->vbytes >= gc->vnext) {
+      if (gc_cleanup(gc, env->prev, env->ret)) return 1;
+      gc->next = gc->len * 2 > GC_MIN ? gc->len * 2 : GC_MIN;
+    }
+  } else if (gc_overflow(gc)) {
+    if (gc_cleanup(gc, env->prev, env->ret)) return 1;
+    //printf("gc: %zu (cleanup)\n", gc->len);
+  }
+  return gc_track(gc, env, id);
+}
+
+// tracks env without collecting first
+int
+gc_track(gc_t * gc, env_t * env, size_t * id) {
+  if (gc->len + 1 > gc->capa) {
+    size_t request = gc->capa ? gc->capa * 2 : 1;
+    addr_t * addrs = mem_realloc(MEM_GC, gc->addrs, sizeof(* addrs) * request);
+    if (addrs == NULL) return 1;
+    gc->addrs = addrs, gc->capa = request;
+  }
+  // envs allocated during an incremental cycle are black
+  char mark = gc->phase == GC_MARKING ? GC_MARK : GC_NIL;
+  gc->addrs[gc->len] = (addr_t) {.val = env, .mark = mark};
+  env->task = gc->task;
+  return * id = gc->len++, 0;
+}
+
+// greys env, every environment enters the worklist at most once per cycle
+void
+gc_push(gc_t * gc, env_t * env) {
+  // a task's envs point into the shared heap, which the task leaves alone
+  if (env == NULL || env->task != gc->task) return;
+  addr_t * addr = &gc->addrs[env->id];
+  if (addr->mark == GC_MARK) return;
+  addr->mark = GC_MARK;
+  gc->work[gc->wlen++] = env;
+}
+
+// the write barrier for storing obj into env: a closure stored during an
+// incremental cycle keeps its environment alive for the rest of the cycle,
+// and an old env pointing to a young one is remembered for minor cycles
+int
+gc_shade(gc_t * gc, env_t * env, obj_t * obj) {
+  if (obj_type(* obj) == OBJ_VEC && gc->phase == GC_MARKING &&
+      obj_v(* obj)->task == gc->task)
+    obj_v(* obj)->mark = GC_MARK;
+  if (obj_type(* obj) != OBJ_FUN) return 0;
+  env_t * to = obj_f(* obj)->env;
+  if (gc->phase == GC_MARKING) gc_push(gc, to);
+  if (gc->nursery != NULL && env->id < gc->old && to->id >= gc->old)
+    return gc_remember(gc, env);
+  return 0;
+}
+
+// scans the worklist until it is empty or about budget slots have been
+// scanned, 0 means no limit; returns whether the worklist is empty
+int
+gc_drain(gc_t * gc, size_t budget) {
+  for (size_t n = 0; gc->wlen && (!budget || n < budget);) {
+    env_t * e = gc->work[--gc->wlen];
+    gc_push(gc, e->prev);
+    for (size_t i = 0; i < e->len; i++) {
+      obj_t obj = e->locs[i].obj;
+      if (obj_type(obj) == OBJ_FUN) gc_push(gc, obj_f(obj)->env);
+      else if (obj_type(obj) == OBJ_VEC && obj_v(obj)->task == gc->task)
+        obj_v(obj)->mark = GC_MARK;
+    }
+    n += e->len + 1;
+  }
+  return !gc->wlen;
+}
+
+void
+gc_ref_env(gc_t * gc, env_t * env) {
+  gc_push(gc, env);
+  gc_drain(gc, 0);
+}
+
+// clears the marks and makes room for every tracked env in the worklist
+int
+gc_reset(gc_t * gc) {
+  if (gc->len > gc->wcapa) {
+    env_t ** work = mem_realloc(MEM_GC, gc->work, sizeof(* work) * gc->len);
+    if (work == NULL) return 1;
+    gc->work = work, gc->wcapa = gc->len;
+  }
+  for (size_t i = 0; i < gc->len; i++) gc->addrs[i].mark = GC_NIL;
+  for (size_t i = 0; i < gc->vlen; i++) gc->vecs[i]->mark = GC_NIL;
+  return gc->wlen = 0, 0;
+}
+
+// frees the unmarked envs from index from on and compacts the table,
+// returns the number of envs left
+size_t
+gc_compact(gc_t * gc, size_t from) {
+  size_t len = from;
+  for (size_t i = from; i < gc->len; i++)
+    if (gc->addrs[i].mark == GC_MARK) {
+      gc->addrs[i].compat = len;
+      gc->addrs[i].val->id = len++;
+    } else if (gc->pool != NULL) {
+      gc_dead(gc, gc->addrs[i].val);
+      STATS(stats.envs_free++);
+    } else {
+      env_free(gc->addrs[i].val);
+    }
+  if (gc->pool != NULL) gc_sweep(gc);
+  for (size_t i = from; i < gc->len; i++) {
+    addr_t * addr = &gc->addrs[i];
+    if (addr->mark == GC_MARK)
+      gc->addrs[addr->compat] = * addr;
+  }
+  STATS(
+    stats.gc_cycles++, stats.gc_marked += len;
+    if (len > stats.gc_marked_max) stats.gc_marked_max = len);
+  gc->phase = GC_IDLE;
+  return gc->len = len;
+}
+
+int
+gc_cleanup(gc_t * gc, env_t * prev, env_t * stack) {
+  double begin = stats_clock();
+  if (gc_reset(gc)) return 1;
+  if (gc->pool != NULL && gc->len >= GC_PAR_MIN) {
+    if (gc_mark_par(gc, prev, stack)) return 1;
+  } else {
+    gc_ref_env(gc, prev);
+    for (env_t * e = stack; e != NULL; e = e->ret)
+      gc_ref_env(gc, e);
+  }
+  if (gc->rc) gc_drop_dead(gc);
+  gc_compact(gc, 0);
+  gc_vec_sweep(gc);
+  STATS(stats_pause(stats_lap(PHA_GC, begin) - begin));
+  return 0;
+}
+
+// one bounded slice of an incremental cycle, run before env is tracked
+int
+gc_step(gc_t * gc, env_t * env) {
+  if (gc->phase == GC_IDLE && gc->len < gc->next && gc->vbytes < gc->vnext)
+    return 0;
+  double begin = stats_clock();
+  if (gc->phase == GC_IDLE) {
+    if (gc_reset(gc)) return 1;
+    for (env_t * e = env->ret; e != NULL; e = e->ret) gc_push(gc, e);
+    gc->phase = GC_MARKING;
+  }
+  // env is black, so what it points to must not stay white
+  gc_push(gc, env->prev);
+  if (gc_drain(gc, gc->budget)) {
+    size_t live = gc_compact(gc, 0);
+    gc->next = live * 2 > GC_MIN ? live * 2 : GC_MIN;
+    gc_vec_sweep(gc);
+  }
+  STATS(stats_pause(stats_lap(PHA_GC, begin) - begin));
+  return 0;
+}
+
+// frees every env and vector left and the heap itself
+void
+gc_release(gc_t * gc) {
+  gc_cleanup(gc, NULL, NULL);
+  if (gc->pool != NULL) gc_pool_free(gc->pool);
+  if (gc->nursery != NULL) gc_nursery_free(gc->nursery);
+  mem_free(gc->addrs);
+  mem_free(gc->work);
+  mem_free(gc->rem);
+  for (size_t i = 0; i < gc->vlen; i++) mem_free(gc->vecs[i]);
+  mem_free(gc->vecs);
+  mem_free(gc->vroots);
+  mem_free(gc);
+}
+
+// the closure of node over prev, made once per pair so that a loop or a
+// recursive body reuses it; it lives as long as prev
+fun_t *
+fun_get(node_t * node, env_t * prev) {
+  for (fun_t * fun = prev->funs; fun != NULL; fun = fun->next)
+    if (fun->node == node) return fun;
+  fun_t * fun = mem_alloc(MEM_ENV, sizeof(* fun));
+  if (fun == NULL) return NULL;
+  fun->env = prev, fun->node = node, fun->next = prev->funs;
+  return prev->funs = fun;
+}
+
+int
+lt(int a, int b, tok_t * tok, const char * file, int * ret) {
+  (void) tok; (void) file;
+  return * ret = a < b, 0;
+}
+
+int
+gt(int a, int b, tok_t * tok, const char * file, int * ret) {
+  (void) tok; (void) file;
+  return * ret = a > b, 0;
+}
+
+int
+eq(int a, int b, tok_t * tok, const char * file, int * ret) {
+  (void) tok; (void) file;
+  return * ret = a == b, 0;
+}
+
+int
+add(int a, int b, tok_t * tok, const char * file, int * ret) {
+  if ((b > 0 && a > INT_MAX - b) ||
+      (b < 0 && a < INT_MIN - (b + 1) + 1))
+    return error(tok, file, "integer overflow: %d + %d\n", a, b), 1;
+  return * ret = a + b, 0;
+}
+
+int
+sub(int a, int b, tok_t * tok, const char * file, int * ret) {
+  if ((b > 0 && a < INT_MIN + b) ||
+      (b < 0 && a > INT_MAX + b))
+    return error(tok, file, "integer overflow: %d - %d\n", a, b), 1;
+  return * ret = b < 0 ? a - (b + 1) + 1 : a - b, 0;
+}
+
+int
+mul(int a, int b, tok_t * tok, const char * file, int * ret) {
+  int c = a * b;
+  if (b && c / b != a)
+    return error(tok, file, "integer overflow: %d * %d\n", a, b), 1;
+  return * ret = c, 0;
+}
+
+int
+idiv(int a, int b, tok_t * tok, const char * file, int * ret) {
+  if (!b)
+    return error(tok, file, "division by zero: %d / %d\n", a, b), 1;
+  return * ret = a / b, 0;
+}
+
+int
+mod(int a, int b, tok_t * tok, const char * file, int * ret) {
+  if (!b)
+    return error(tok, file, "division by zero: %d %% %d\n", a, b), 1;
+  return * ret = a % b, 0;
+}
+
+int
+and(int a, int b, tok_t * tok, const char * file, int * ret) {
+  (void) tok; (void) file;
+  return * ret = a && b, 0;
+}
+
+int
+or(int a, int b, tok_t * tok, const char * file, int * ret) {
+  (void) tok; (void) file;
+  return * ret = a || b, 0;
+}
+
+int
+not(int a, int b, tok_t * tok, const char * file, int * ret) {
+  (void) b; (void) tok; (void) file;
+  return * ret = !a, 0;
+}
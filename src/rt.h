@@ -0,0 +1,22 @@
+#ifndef RT_H
+#define RT_H
+
+#include "scan.h"
+
+// the runtime translated programs link against, see emit.c
+
+typedef int calc_t(int a, int b, tok_t * tok, const char * file, int * ret);
+
+calc_t lt, gt, eq, add, sub, mul, idiv, mod, and, or, not;
+
+gc_t * gc_heap(void);
+void gc_release(gc_t * gc);
+void env_get(env_t * env, var_t * var, obj_t * obj);
+fun_t * fun_get(node_t * node, env_t * prev);
+
+int vec_check(int id, size_t i, obj_t obj, tok_t * tok, gc_t * gc,
+    const char * file);
+int vec_apply(int id, tok_t ** toks, obj_t * args, gc_t * gc,
+    const char * file, obj_t * obj);
+
+#endif
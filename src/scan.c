@@ -2,53 +2,53 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
-#include "scan.h"
+#include "rt.h"
+#include "stats.h"
+#include "mem.h"
+#include "prof.h"
+#include "memo.h"
+#include "snap.h"
 
 const char *
-skip(const char * str, const char ** line, size_t * lnum) {
-  for (;; str++)
-    if (* str == '\n') (* lnum)++, * line = str + 1;
-    else if (* str == ' ' || * str == '\t') (void) line;
-    else break;
+skip(const char * str) {
+  while (* str == ' ' || * str == '\t' || * str == '\n') str++;
   return str;
 }
 
 int
-scan(const char * str, const char ** begin, const char ** end,
-     const char ** line, size_t * lnum) {
-  const char * l = * line;
-  size_t num = * lnum;
-  str = skip(str, &l, &num);
+scan(const char * str, const char ** begin, const char ** end) {
+  str = skip(str);
   const char * token = str;
   char c = * str;
   if (c >= '0' && c <= '9') {
     while ((c = * ++str) >= '0' && c <= '9');
-    return * begin = token, * end = str, * line = l, * lnum = num, TOK_NUM;
+    return * begin = token, * end = str, TOK_NUM;
   } else if (c == '#') {
     if ((c = * ++str) == 't' || c == 'f')
       if (!(((c = * ++str) >= '0' && c <= '9') ||
             (c >= 'a' && c <= 'z') ||
             (c >= 'A' && c <= 'Z')))
-        return * begin = token, * end = str, * line = l, * lnum = num, TOK_SYM;
+        return * begin = token, * end = str, TOK_SYM;
     for (; ((c >= '0' && c <= '9') ||
             (c >= 'a' && c <= 'z') ||
             (c >= 'A' && c <= 'Z')); c = * ++str);
-    return * begin = token, * end = str, * line = l, * lnum = num, TOK_NIL;
+    return * begin = token, * end = str, TOK_NIL;
   } else if (c == '(') {
-    return * begin = token, * end = str + 1, * line = l, * lnum = num,
+    return * begin = token, * end = str + 1,
            TOK_LPAREN;
   } else if (c == ')') {
-    return * begin = token, * end = str + 1, * line = l, * lnum = num,
+    return * begin = token, * end = str + 1,
            TOK_RPAREN;
   } else if (c == '\0') {
-    return * begin = token, * end = str, * line = l, * lnum = num, TOK_EOF;
+    return * begin = token, * end = str, TOK_EOF;
   } else if ((c >= 'a' && c <= 'z') ||
              (c >= 'A' && c <= 'Z')) {
     while (((c = * ++str) >= '0' && c <= '9') ||
            (c >= 'a' && c <= 'z') ||
            (c >= 'A' && c <= 'Z') ||
-           (c == '-'));
-    return * begin = token, * end = str, * line = l, * lnum = num, TOK_ID;
+           (c == '-') ||
+           (c == '!'));
+    return * begin = token, * end = str, TOK_ID;
   } else if (c == '<' ||
              c == '>' ||
              c == '=' ||
@@ -59,30 +59,29 @@ scan(const char * str, const char ** begin, const char ** end,
     if (c == '-') {
       if ((c = * ++str) >= '0' && c <= '9') {
         while ((c = * ++str) >= '0' && c <= '9');
-        return * begin = token, * end = str, * line = l, * lnum = num, TOK_NUM;
+        return * begin = token, * end = str, TOK_NUM;
       } else {
-        return * begin = token, * end = str, * line = l, * lnum = num, TOK_ID;
+        return * begin = token, * end = str, TOK_ID;
       }
     }
-    return * begin = token, * end = str + 1, * line = l, * lnum = num, TOK_ID;
+    return * begin = token, * end = str + 1, TOK_ID;
   } else {
-    return * begin = token, * end = str, * line = l, * lnum = num, TOK_NIL;
+    return * begin = token, * end = str, TOK_NIL;
   }
 }
 
 int
 peek(const char * str) {
-  const char * begin, * end, * line;
-  size_t lnum = 0;
-  return scan(str, &begin, &end, &line, &lnum);
+  const char * begin, * end;
+  return scan(str, &begin, &end);
 }
 
 int
-match(const char ** str, int tok, const char ** line, size_t * lnum) {
-  const char * begin, * end, * l = * line;
-  size_t num = * lnum;
-  if (scan(* str, &begin, &end, &l, &num) != tok) return 1;
-  return * str = end, * line = l, * lnum = num, 0;
+match(const char ** str, int tok) {
+  const char * begin, * end;
+  if (scan(* str, &begin, &end) != tok) return 1;
+  STATS(stats.toks++);
+  return * str = end, 0;
 }
 
 const char *
@@ -125,18 +124,24 @@ nodtoa(int tok) {
     "OR",
     "NOT",
     "PRN",
-    "PRB"
+    "PRB",
+    "VEC",
+    "WHL",
+    "QOP",
+    "QIF",
+    "INL"
   };
   return names[tok];
 }
 
 node_t *
 node_new(node_t * parent, int type) {
-  node_t * node = malloc(sizeof(* node));
+  node_t * node = mem_alloc(MEM_AST, sizeof(* node));
   if (node == NULL) return NULL;
   node->parent = parent;
   node->front = node->back = node->next = NULL;
   node->type = type;
+  STATS(stats.nodes++);
   return node;
 }
 
@@ -156,7 +161,7 @@ node_add(node_t * node, node_t * child) {
 void
 node_dump(node_t * root) {
   size_t capa = 2;
-  node_t ** stack = malloc(sizeof(* stack) * capa);
+  node_t ** stack = mem_alloc(MEM_AST, sizeof(* stack) * capa);
   if (stack == NULL) return;
   node_t nil;
   size_t indent = 0;
@@ -171,7 +176,7 @@ node_dump(node_t * root) {
                node->type == NOD_SYM ||
                node->type == NOD_ID) {
       tok_t * tok = &node->tok;
-      printf("%.*s ", (int) (tok->end - tok->begin), tok->begin);
+      printf("%.*s ", (int) tok->len, tok->begin);
     } else if (node->type == NOD_INT) {
       printf("%d ", node->val.i);
     } else if (node->type == NOD_BOL) {
@@ -202,21 +207,28 @@ node_dump(node_t * root) {
                node->type == NOD_OR ||
                node->type == NOD_NOT ||
                node->type == NOD_PRN ||
-               node->type == NOD_PRB) {
+               node->type == NOD_PRB ||
+               node->type == NOD_VEC ||
+               node->type == NOD_WHL ||
+               node->type == NOD_QOP ||
+               node->type == NOD_QIF) {
     } else {
       printf("? ");
     }
+    const char * name, * line;
+    size_t lnum;
+    lines_find(node->tok.begin, &name, &line, &lnum);
     printf(COL_GREEN "%s" COL_RST " "
            COL_YELLOW "%zu" COL_RST " "
            COL_MAGENTA "%p" COL_RST "\n",
-           nodtoa(node->type), node->tok.lnum, (void *) node);
+           nodtoa(node->type), lnum, (void *) node);
     node = node->front;
     size_t size = 0;
     for (node_t * next = node; next != NULL; next = next->next) size++;
     size_t request = len + 2 + size;
     if (request > capa) {
-      node_t ** ptr = realloc(stack, sizeof(* ptr) * request);
-      if (ptr == NULL) { free(stack); return; }
+      node_t ** ptr = mem_realloc(MEM_AST, stack, sizeof(* ptr) * request);
+      if (ptr == NULL) { mem_free(stack); return; }
       capa = request, stack = ptr;
     }
     len++, stack[len++] = &nil, len += size;
@@ -226,13 +238,13 @@ node_dump(node_t * root) {
     }
     indent++;
   }
-  free(stack);
+  mem_free(stack);
 }
 
 void
 node_free(node_t * root) {
   size_t capa = 2;
-  node_t ** stack = malloc(sizeof(* stack) * capa);
+  node_t ** stack = mem_alloc(MEM_AST, sizeof(* stack) * capa);
   if (stack == NULL) return;
   node_t nil;
   size_t len = 0;
@@ -241,9 +253,12 @@ node_free(node_t * root) {
     node_t * node = stack[--len];
     if (node == &nil) {
       node_t * parent = stack[--len];
-      if (parent->type == NOD_DEF)
-        free(parent->val.d.args);
-      free(parent);
+      if (parent->type == NOD_DEF) {
+        def_t * def = &parent->val.d;
+        mem_free(def->args), mem_free(def->scope);
+        if (def->map != NULL) map_free(def->map), mem_free(def->map);
+      }
+      mem_free(parent);
       continue;
     }
     node = node->front;
@@ -251,106 +266,89 @@ node_free(node_t * root) {
     for (node_t * next = node; next != NULL; next = next->next) size++;
     size_t request = len + 2 + size;
     if (request > capa) {
-      node_t ** ptr = realloc(stack, sizeof(* ptr) * request);
-      if (ptr == NULL) { free(stack); return; }
+      node_t ** ptr = mem_realloc(MEM_AST, stack, sizeof(* ptr) * request);
+      if (ptr == NULL) { mem_free(stack); return; }
       capa = request, stack = ptr;
     }
     len++, stack[len++] = &nil;
     for (; node != NULL; node = node->next)
       stack[len++] = node;
   }
-  free(stack);
+  mem_free(stack);
 }
 
 int
-fetch(const char ** str, int id, node_t * parent, int type,
-      const char ** line, size_t * lnum) {
-  const char * begin, * end, * l = * line;
-  size_t num = * lnum;
-  int ret = scan(* str, &begin, &end, &l, &num);
-  if (ret != id) return 1;
+fetch(const char ** str, int id, node_t * parent, int type) {
+  const char * begin, * end;
+  int ret = scan(* str, &begin, &end);
+  if (ret != id || end - begin > UINT32_MAX) return 1;
   node_t * node = node_new(parent, type);
   if (node == NULL) return 1;
   tok_t * tok = &node->tok;
   tok->begin = begin;
-  tok->end = end;
-  tok->line = l;
-  tok->lnum = num;
+  tok->len = (uint32_t) (end - begin);
   tok->id = ret;
-  return node_add(parent, node), * str = end, * line = l, * lnum = num, 0;
-}
-
-void
-error_begin(const char * str, const char * file,
-            const char * line, size_t lnum) {
-  fprintf(stderr, "%s:%zu:%zu: error: ",
-          file, lnum + 1, (size_t) (str - line + 1));
+  STATS(stats.toks++);
+  return node_add(parent, node), * str = end, 0;
 }
 
+// a NULL file keeps quiet, the caller parses again to report the error
 void
-error_end(const char * str, const char * line) {
-  const char * end = line;
-  while (* end && * end != '\n') end++;
-  fprintf(stderr, "%.*s\n", (int) (end - line), line);
-  for (const char * ptr = line; ptr < str; ptr++) fprintf(stderr, " ");
-  fprintf(stderr, "^-----\n");
-}
-
-#define error(tok, file, ...) \
-    (error_begin(tok->begin, file, tok->line, tok->lnum), \
-     fprintf(stderr, __VA_ARGS__), \
-     error_end(tok->begin, tok->line))
-
-void
-syntax_error(const char * str, int tok,
-             const char * file, const char * line, size_t lnum) {
-  const char * s = str, * l = line;
-  size_t num = lnum;
-  if (* (s = skip(str, &l, &num))) str = s, line = l, lnum = num;
-  error_begin(str, file, line, lnum);
+syntax_error(const char * str, int tok, const char * file) {
+  if (file == NULL) return;
+  const char * s = skip(str);
+  if (* s) str = s;
+  error_begin(str, file);
   fprintf(stderr, "syntax error, unexpected token %s\n", toktoa(tok));
-  error_end(str, line);
+  error_end(str);
 }
 
 int
-parse(const char ** str, node_t * parent,
-      const char * file, const char ** line, size_t * lnum) {
+parse(const char ** str, node_t * parent, const char * file) {
   int tok = peek(* str);
   if (tok == TOK_LPAREN) {
-    if (fetch(str, TOK_LPAREN, parent, NOD_NIL, line, lnum)) return 1;
+    if (fetch(str, TOK_LPAREN, parent, NOD_NIL)) return 1;
     node_t * node = parent->back;
     while ((tok = peek(* str)) != TOK_RPAREN)
       if (tok == TOK_LPAREN) {
-        if (parse(str, node, file, line, lnum)) return 1;
+        if (parse(str, node, file)) return 1;
       } else if (tok == TOK_NUM) {
-        if (fetch(str, TOK_NUM, node, NOD_NUM, line, lnum)) return 1;
+        if (fetch(str, TOK_NUM, node, NOD_NUM)) return 1;
       } else if (tok == TOK_SYM) {
-        if (fetch(str, TOK_SYM, node, NOD_SYM, line, lnum)) return 1;
+        if (fetch(str, TOK_SYM, node, NOD_SYM)) return 1;
       } else if (tok == TOK_ID) {
-        if (fetch(str, TOK_ID, node, NOD_ID, line, lnum)) return 1;
+        if (fetch(str, TOK_ID, node, NOD_ID)) return 1;
       } else {
-        return syntax_error(* str, tok, file, * line, * lnum), 1;
+        return syntax_error(* str, tok, file), 1;
       }
-    if (match(str, TOK_RPAREN, line, lnum)) return 1;
+    if (match(str, TOK_RPAREN)) return 1;
     return 0;
   } else if (tok == TOK_EOF) {
     return 0;
   } else {
-    return syntax_error(* str, tok, file, * line, * lnum), 1;
+    return syntax_error(* str, tok, file), 1;
   }
 }
 
+int
+parse_all(const char ** str, node_t * parent, const char * file) {
+  while (peek(* str) != TOK_EOF)
+    if (parse(str, parent, file)) return 1;
+  return 0;
+}
+
 void
 map_init(map_t * map, map_t * prev) {
   map->prev = prev;
+  map->base = map;
   map->begin = map->end = NULL;
   map->len = map->capa = 0;
 }
 
 void
 map_free(map_t * map) {
-  free(map->begin), map->begin = NULL;
-  free(map->end), map->end = NULL;
+  mem_free(map->begin), map->begin = NULL;
+  mem_free(map->end), map->end = NULL;
   map->len = map->capa = 0;
 }
 
@@ -366,15 +364,18 @@ map_get(map_t * map, const char * begin, const char * end, var_t * var) {
   return 0;
 }
 
+// appends a name known to be new
 int
-map_set(map_t * map, const char * begin, const char * end, var_t * var) {
-  if (map_get(map, begin, end, var)) return 0;
+map_add(map_t * map, const char * begin, const char * end, var_t * var) {
   if (map->len + 1 > map->capa) {
     size_t request = map->capa ? map->capa * 2 : 1;
-    const char ** bptr = realloc(map->begin, sizeof(* bptr) * request);
+    const char ** bptr =
+        mem_realloc(MEM_MAP, map->begin, sizeof(* bptr) * request);
     if (bptr == NULL) return 1;
-    const char ** eptr = realloc(map->end, sizeof(* eptr) * request);
-    if (eptr == NULL) return free(bptr), 1;
+    map->begin = bptr;
+    const char ** eptr =
+        mem_realloc(MEM_MAP, map->end, sizeof(* eptr) * request);
+    if (eptr == NULL) return 1;
     map->begin = bptr, map->end = eptr, map->capa = request;
   }
   map->begin[map->len] = begin;
@@ -383,6 +384,12 @@ map_set(map_t * map, const char * begin, const char * end, var_t * var) {
   return map->len++, 0;
 }
 
+int
+map_set(map_t * map, const char * begin, const char * end, var_t * var) {
+  if (map_get(map, begin, end, var)) return 0;
+  return map_add(map, begin, end, var);
+}
+
 void
 map_dump(map_t * map) {
   for (size_t i = 0; map != NULL; map = map->prev, i++) {
@@ -397,7 +404,7 @@ map_dump(map_t * map) {
 int
 tokcmp(tok_t * tok, const char * str) {
   size_t len = strlen(str);
-  return (len != (size_t) (tok->end - tok->begin) ||
+  return (len != (size_t) tok->len ||
           memcmp(tok->begin, str, len));
 }
 
@@ -406,7 +413,7 @@ toktoi(tok_t * tok, const char * file, int * ret) {
   int i = 0, sign = 0;
   const char * ptr = tok->begin;
   if (* ptr == '-') sign = 1, ptr++;
-  for (; ptr < tok->end; ptr++) {
+  for (; ptr < tok_end(tok); ptr++) {
     if (i > INT_MAX / 10 ||
         i < INT_MIN / 10)
       return error(tok, file, "integer buffer overflow\n"), 1;
@@ -427,6 +434,42 @@ toktoi(tok_t * tok, const char * file, int * ret) {
 
 int semantic(node_t * parent, map_t * prev, const char * file);
 
+// whether the nodes print, store into a vector or define anything, defines
+// into the current frame aside when local is set; bodies of nested funs are
+// their own
+int
+effects(node_t * node, int local) {
+  for (; node != NULL; node = node->next)
+    if (node->type == NOD_PRN || node->type == NOD_PRB) return 1;
+    else if (node->type == NOD_VEC && node->val.i == VEC_SET) return 1;
+    else if (node->type == NOD_DEF) continue;
+    else if (node->type == NOD_SET &&
+             (!local || node->front->next->val.v.env)) return 1;
+    else if (effects(node->front, local)) return 1;
+  return 0;
+}
+
+// whether the nodes call anything, bodies of nested funs aside
+int
+calls(node_t * node) {
+  for (; node != NULL; node = node->next)
+    if (node->type == NOD_FUN) return 1;
+    else if (node->type != NOD_DEF && calls(node->front)) return 1;
+  return 0;
+}
+
+// calls whose arguments are free of effects and hold two calls or more
+// may have them evaluated in parallel; the other arguments must call
+// nothing, which could have effects while the tasks run
+int
+spread(node_t * args) {
+  size_t n = 0;
+  for (node_t * arg = args; arg != NULL; arg = arg->next)
+    if (arg->type == NOD_FUN) n++;
+    else if (arg->type != NOD_DEF && calls(arg->front)) return 0;
+  return n >= 2 && !effects(args, 0);
+}
+
 int
 variables(node_t * node, map_t * prev, const char * file) {
   for (; node != NULL; node = node->next)
@@ -441,9 +484,9 @@ variables(node_t * node, map_t * prev, const char * file) {
     } else if (node->type == NOD_ID) {
       tok_t * tok = &node->tok;
       var_t var;
-      if (!map_get(prev, tok->begin, tok->end, &var))
+      if (!map_get(prev, tok->begin, tok_end(tok), &var))
         return error(tok, file, "variable %.*s is undefined\n",
-                     (int) (tok->end - tok->begin), tok->begin), 1;
+                     (int) tok->len, tok->begin), 1;
       node->val.v = var, node->type = NOD_VAR;
     }
   return 0;
@@ -475,6 +518,50 @@ binary(node_t * parent, map_t * prev, int type, int multi, const char * file) {
   return parent->type = type, 0;
 }
 
+// keeps the parameters and a snapshot of the enclosing scopes, names
+// defined after this point stay invisible to the body
+int
+defer(def_t * def, map_t * map, map_t * prev) {
+  size_t depth = 0;
+  for (map_t * m = prev; m != NULL; m = m->prev) depth++;
+  scope_t * scope = mem_alloc(MEM_MAP, sizeof(* scope) * depth);
+  if (scope == NULL) return 1;
+  map_t * own = mem_alloc(MEM_MAP, sizeof(* own));
+  if (own == NULL) return mem_free(scope), 1;
+  size_t i = 0;
+  for (map_t * m = prev; m != NULL; m = m->prev, i++)
+    scope[i].map = m->base, scope[i].len = m->len;
+  * own = * map, own->base = own;
+  def->scope = scope, def->depth = depth, def->map = own;
+  STATS(stats.defs_lazy++);
+  return 0;
+}
+
+// resolves a deferred body against its snapshot, nested defs are deferred
+// again against views that share the names of the live maps
+int
+resolve(node_t * parent, const char * file) {
+  def_t * def = &parent->val.d;
+  map_t * views = mem_alloc(MEM_MAP, sizeof(* views) * def->depth);
+  if (views == NULL) return 1;
+  for (size_t i = 0; i < def->depth; i++) {
+    views[i] = * def->scope[i].map;
+    views[i].len = views[i].capa = def->scope[i].len;
+    views[i].prev = i + 1 < def->depth ? &views[i + 1] : NULL;
+  }
+  def->map->prev = views;
+  int err = variables(parent->front->next->next, def->map, file);
+  def->map->prev = NULL;
+  mem_free(views);
+  if (err) return 1;
+  def->env = def->map->len;
+  def->pure = !effects(parent->front->next->next, 1);
+  mem_free(def->scope), def->scope = NULL;
+  if (!opt.plain) quicken(parent->front->next->next);
+  STATS(stats.defs_resolved++);
+  return 0;
+}
+
 int
 semantic(node_t * parent, map_t * prev, const char * file) {
   tok_t * ptok = &parent->tok;
@@ -484,6 +571,7 @@ semantic(node_t * parent, map_t * prev, const char * file) {
   } else if (node->type == NOD_NIL) {
     if (semantic(node, prev, file) ||
         variables(node->next, prev, file)) return 1;
+    parent->val.i = spread(node->next);
     return parent->type = NOD_FUN, 0;
   } else if (node->type == NOD_NUM) {
     tok_t * tok = &node->tok;
@@ -493,8 +581,10 @@ semantic(node_t * parent, map_t * prev, const char * file) {
     return error(tok, file, "boolean is not a function\n"), 1;
   } else if (node->type == NOD_ID) {
     tok_t * tok = &node->tok;
-    if (map_get(prev, tok->begin, tok->end, &node->val.v)) {
+    size_t arity;
+    if (map_get(prev, tok->begin, tok_end(tok), &node->val.v)) {
       if (variables(node->next, prev, file)) return 1;
+      parent->val.i = spread(node->next);
       return node->type = NOD_VAR, parent->type = NOD_FUN, 0;
     } else if (!tokcmp(tok, "fun")) {
       if (node->next == NULL) return 1;
@@ -507,22 +597,29 @@ semantic(node_t * parent, map_t * prev, const char * file) {
       }
       map_t map;
       map_init(&map, NULL);
-      size_t * args = malloc(sizeof(* args) * len);
+      size_t * args = mem_alloc(MEM_AST, sizeof(* args) * len);
       if (args == NULL) return 1;
       size_t i = 0;
       for (node_t * arg = node->next->front; arg != NULL; arg = arg->next) {
         tok_t * t = &arg->tok;
-        if (map_get(&map, t->begin, t->end, NULL))
+        if (map_get(&map, t->begin, tok_end(t), NULL))
           return error(t, file, "parameter names are duplicated\n"),
-                 free(args), 1;
+                 mem_free(args), 1;
         var_t v;
-        if (map_set(&map, t->begin, t->end, &v)) return free(args), 1;
+        if (map_set(&map, t->begin, tok_end(t), &v)) return mem_free(args), 1;
         args[i++] = v.off;
       }
-      map.prev = prev;
-      if (variables(node->next->next, &map, file)) return free(args), 1;
       def_t * def = &parent->val.d;
       def->args = args, def->len = len, def->env = map.len;
+      def->scope = NULL, def->map = NULL, def->pure = 0, def->memo = NULL;
+      // memoization needs to see every define up front
+      if (opt.lazy && !opt.strict && !opt.memo) {
+        if (defer(def, &map, prev)) return map_free(&map), mem_free(args), 1;
+        return parent->type = NOD_DEF, 0;
+      }
+      map.prev = prev;
+      if (variables(node->next->next, &map, file)) return mem_free(args), 1;
+      def->env = map.len, def->pure = !effects(node->next->next, 1);
       map_free(&map);
       return parent->type = NOD_DEF, 0;
     } else if (!tokcmp(tok, "define")) {
@@ -540,7 +637,7 @@ semantic(node_t * parent, map_t * prev, const char * file) {
         return error(vtok, file, "multiple variable values is not allowed\n"),
                1;
       }
-      if (map_set(prev, ntok->begin, ntok->end, &name->val.v)) return 1;
+      if (map_set(prev, ntok->begin, tok_end(ntok), &name->val.v)) return 1;
       if (variables(value, prev, file)) return 1;
       name->type = NOD_VAR;
       return parent->type = NOD_SET, 0;
@@ -556,6 +653,15 @@ semantic(node_t * parent, map_t * prev, const char * file) {
         return error(ptok, file, "the else-statement is empty\n"), 1;
       if (variables(cond, prev, file)) return 1;
       return parent->type = NOD_IF, 0;
+    } else if (!tokcmp(tok, "while")) {
+      node_t * cond = node->next;
+      if (cond == NULL)
+        return error(ptok, file, "the condition is empty\n"), 1;
+      if (cond->next == NULL)
+        return error(ptok, file, "the loop body is empty\n"), 1;
+      // the body shares the enclosing frame, like the branches of if
+      if (variables(cond, prev, file)) return 1;
+      return parent->type = NOD_WHL, 0;
     } else if (!tokcmp(tok, "<")) {
       return binary(parent, prev, NOD_LT, 0, file);
     } else if (!tokcmp(tok, ">")) {
@@ -598,160 +704,42 @@ semantic(node_t * parent, map_t * prev, const char * file) {
       }
       if (variables(node->next, prev, file)) return 1;
       return parent->type = NOD_PRB, 0;
+    } else if ((parent->val.i = vec_find(tok, &arity)) >= 0) {
+      size_t n = 0;
+      for (node_t * arg = node->next; arg != NULL; arg = arg->next) n++;
+      if (n != arity)
+        return error(ptok, file, "%.*s requires %zu operand%s\n",
+                     (int) tok->len, tok->begin, arity,
+                     arity == 1 ? "" : "s"), 1;
+      if (variables(node->next, prev, file)) return 1;
+      return parent->type = NOD_VEC, 0;
     } else {
       return error(tok, file, "variable %.*s is undefined\n",
-                   (int) (tok->end - tok->begin), tok->begin), 1;
+                   (int) tok->len, tok->begin), 1;
     }
   } else {
     return 1;
   }
 }
 
-env_t *
-env_new(env_t * prev, env_t * ret, size_t len) {
-  env_t * env = malloc(sizeof(* env));
-  if (env == NULL) return NULL;
-  loc_t * locs = malloc(sizeof(* env->locs) * len);
-  if (locs == NULL) return free(env), NULL;
-  for (size_t i = 0; i < len; i++) {
-    locs[i].obj.type = OBJ_NIL;
-  }
-  env->ret = ret;
-  env->prev = prev;
-  env->locs = locs;
-  env->len = len;
-  return env;
-}
-
-void
-env_free(env_t * env) {
-  free(env->locs);
-  free(env);
-}
-
-int
-env_add(env_t * env, size_t len) {
-  if (len <= env->len) return 0;
-  loc_t * locs = realloc(env->locs, sizeof(* locs) * len);
-  if (locs == NULL) return 1;
-  for (size_t i = env->len; i < len; i++) {
-    locs[i].obj.type = OBJ_NIL;
-  }
-  env->locs = locs;
-  env->len = len;
-  return 0;
-}
-
-void
-env_dump(env_t * env, int ret);
-
-void
-env_get(env_t * env, var_t * var, obj_t * obj) {
-  for (size_t i = 0; i < var->env; i++) env = env->prev;
-  * obj = env->locs[var->off].obj;
-}
-
-void
-env_set(env_t * env, var_t * var, obj_t * obj) {
-  for (size_t i = 0; i < var->env; i++) env = env->prev;
-  env->locs[var->off].obj = * obj;
-}
-
-void
-env_dump(env_t * env, int ret) {
-  for (size_t i = 0; env != NULL; env = ret ? env->ret : env->prev, i++) {
-    printf("--- scope %zu --- %p\n", i, (void *) env);
-    printf("  variables size: %zu\n", env->len);
-  }
-  printf("---------------\n");
-}
-
+// the heap of a run, with threads for parallel arguments if asked for
 gc_t *
 gc_new(void) {
-  gc_t * gc = malloc(sizeof(* gc));
+  gc_t * gc = gc_heap();
   if (gc == NULL) return NULL;
-  gc->addrs = NULL;
-  gc->capa = gc->len = 0;
+  // tasks would race on reference counts, counters and the profile
+  if (opt.eval_threads > 1 && !gc->rc && !opt.stats && !opt.prof)
+    gc->par = par_pool_new(opt.eval_threads);
   return gc;
 }
 
-int
-gc_overflow(gc_t * gc) {
-  //printf("gc: %zu\n", gc->len);
-  return gc->len > 0;
-}
-
-int
-gc_add(gc_t * gc, env_t * env, size_t * id) {
-  if (gc_overflow(gc)) {
-    if (gc_cleanup(gc, env->prev, env->ret)) return 1;
-    //printf("gc: %zu (cleanup)\n", gc->len);
-  }
-  if (gc->len + 1 > gc->capa) {
-    size_t request = gc->capa ? gc->capa * 2 : 1;
-    addr_t * addrs = realloc(gc->addrs, sizeof(* addrs) * request);
-    if (addrs == NULL) return 1;
-    gc->addrs = addrs, gc->capa = request;
-  }
-  gc->addrs[gc->len] = (addr_t) {.val = env};
-  return * id = gc->len++, 0;
-}
-
-void
-gc_ref_env(gc_t * gc, env_t * env) {
-  for (env_t * e = env; e != NULL; e = e->prev) {
-    addr_t * addr = &gc->addrs[e->id];
-    if (addr->mark == GC_MARK) break;
-    addr->mark = GC_MARK;
-  }
-  for (env_t * e = env; e != NULL; e = e->prev) {
-    for (size_t i = 0; i < e->len; i++) {
-      obj_t * obj = &e->locs[i].obj;
-      if (obj->type != OBJ_FUN) continue;
-      env_t * to = obj->val.f.env;
-      if (gc->addrs[to->id].mark == GC_MARK) continue;
-      gc_ref_env(gc, to);
-    }
-  }
-}
-
-int
-gc_cleanup(gc_t * gc, env_t * prev, env_t * stack) {
-  for (size_t i = 0; i < gc->len; i++) gc->addrs[i].mark = GC_NIL;
-  gc_ref_env(gc, prev);
-  for (env_t * e = stack; e != NULL; e = e->ret)
-    gc_ref_env(gc, e);
-  size_t len = 0;
-  for (size_t i = 0; i < gc->len; i++)
-    if (gc->addrs[i].mark == GC_MARK) {
-      gc->addrs[i].compat = len;
-      gc->addrs[i].val->id = len++;
-    } else {
-      env_free(gc->addrs[i].val);
-    }
-  for (size_t i = 0; i < gc->len; i++) {
-    addr_t * addr = &gc->addrs[i];
-    if (addr->mark == GC_MARK)
-      gc->addrs[addr->compat] = * addr;
-  }
-  return gc->len = len, 0;
-}
-
 void
 gc_free(gc_t * gc) {
-  gc_cleanup(gc, NULL, NULL);
-  free(gc->addrs);
-  free(gc);
+  struct par_pool * par = gc->par;
+  gc_release(gc);
+  if (par != NULL) par_pool_free(par);
 }
 
-void
-fun_init(fun_t * fun, node_t * node, env_t * prev) {
-  fun->env = prev;
-  fun->node = node;
-}
-
-typedef int calc_t(int a, int b, tok_t * tok, const char * file, int * ret);
-
 int
 calc(node_t * parent, env_t * prev, env_t * stack,
      gc_t * gc, calc_t * cb, char in, char out,
@@ -761,198 +749,232 @@ calc(node_t * parent, env_t * prev, env_t * stack,
   obj_t a;
   if (eval(node, prev, stack, gc, file, &a)) return 1;
   tok_t * atok = &node->tok;
-  if (a.type != in)
+  if (obj_type(a) != in)
     return error(atok, file, "variable is not %s\n",
                  in == OBJ_INT ? "integer" : "boolean"), 1;
+  int acc = obj_i(a);
   while (node = node->next, node != NULL) {
     obj_t b;
     if (eval(node, prev, stack, gc, file, &b)) return 1;
     tok_t * btok = &node->tok;
-    if (b.type != in)
+    if (obj_type(b) != in)
       return error(btok, file, "variable is not %s\n",
                    in == OBJ_INT ? "integer" : "boolean"), 1;
-    if (cb(a.val.i, b.val.i, ptok, file, &a.val.i)) return 1;
+    if (cb(acc, obj_i(b), ptok, file, &acc)) return 1;
   }
-  if (unary) if (cb(a.val.i, 0, atok, file, &a.val.i)) return 1;
-  return obj->val.i = a.val.i, obj->type = out, 0;
-}
-
-int
-lt(int a, int b, tok_t * tok, const char * file, int * ret) {
-  (void) tok; (void) file;
-  return * ret = a < b, 0;
-}
-
-int
-gt(int a, int b, tok_t * tok, const char * file, int * ret) {
-  (void) tok; (void) file;
-  return * ret = a > b, 0;
-}
-
-int
-eq(int a, int b, tok_t * tok, const char * file, int * ret) {
-  (void) tok; (void) file;
-  return * ret = a == b, 0;
-}
-
-int
-add(int a, int b, tok_t * tok, const char * file, int * ret) {
-  if ((b > 0 && a > INT_MAX - b) ||
-      (b < 0 && a < INT_MIN - (b + 1) + 1))
-    return error(tok, file, "integer overflow: %d + %d\n", a, b), 1;
-  return * ret = a + b, 0;
-}
-
-int
-sub(int a, int b, tok_t * tok, const char * file, int * ret) {
-  if ((b > 0 && a < INT_MIN + b) ||
-      (b < 0 && a > INT_MAX + b))
-    return error(tok, file, "integer overflow: %d - %d\n", a, b), 1;
-  return * ret = b < 0 ? a - (b + 1) + 1 : a - b, 0;
+  if (unary) if (cb(acc, 0, atok, file, &acc)) return 1;
+  return * obj = out == OBJ_INT ? mkint(acc) : mkbol(acc), 0;
 }
 
+// the operator of type, one of NOD_LT to NOD_NOT, over the operands of parent
 int
-mul(int a, int b, tok_t * tok, const char * file, int * ret) {
-  int c = a * b;
-  if (b && c / b != a)
-    return error(tok, file, "integer overflow: %d * %d\n", a, b), 1;
-  return * ret = c, 0;
-}
-
-int
-idiv(int a, int b, tok_t * tok, const char * file, int * ret) {
-  if (!b)
-    return error(tok, file, "division by zero: %d / %d\n", a, b), 1;
-  return * ret = a / b, 0;
-}
-
-int
-mod(int a, int b, tok_t * tok, const char * file, int * ret) {
-  if (!b)
-    return error(tok, file, "division by zero: %d %% %d\n", a, b), 1;
-  return * ret = a % b, 0;
+operate(node_t * parent, int type, env_t * prev, env_t * stack,
+        gc_t * gc, const char * file, obj_t * obj) {
+  if (type == NOD_LT) {
+    return calc(parent, prev, stack, gc, lt, OBJ_INT, OBJ_BOL, 0, file, obj);
+  } else if (type == NOD_GT) {
+    return calc(parent, prev, stack, gc, gt, OBJ_INT, OBJ_BOL, 0, file, obj);
+  } else if (type == NOD_EQ) {
+    return calc(parent, prev, stack, gc, eq, OBJ_INT, OBJ_BOL, 0, file, obj);
+  } else if (type == NOD_ADD) {
+    return calc(parent, prev, stack, gc, add, OBJ_INT, OBJ_INT, 0, file, obj);
+  } else if (type == NOD_SUB) {
+    return calc(parent, prev, stack, gc, sub, OBJ_INT, OBJ_INT, 0, file, obj);
+  } else if (type == NOD_MUL) {
+    return calc(parent, prev, stack, gc, mul, OBJ_INT, OBJ_INT, 0, file, obj);
+  } else if (type == NOD_DIV) {
+    return calc(parent, prev, stack, gc, idiv, OBJ_INT, OBJ_INT, 0, file, obj);
+  } else if (type == NOD_MOD) {
+    return calc(parent, prev, stack, gc, mod, OBJ_INT, OBJ_INT, 0, file, obj);
+  } else if (type == NOD_AND) {
+    return calc(parent, prev, stack, gc, and, OBJ_BOL, OBJ_BOL, 0, file, obj);
+  } else if (type == NOD_OR) {
+    return calc(parent, prev, stack, gc, or, OBJ_BOL, OBJ_BOL, 0, file, obj);
+  } else {
+    return calc(parent, prev, stack, gc, not, OBJ_BOL, OBJ_BOL, 1, file, obj);
+  }
 }
 
+// evaluates the operands of builtin parent in order, checks them and runs
+// it, vectors among the operands are held until it has run
 int
-and(int a, int b, tok_t * tok, const char * file, int * ret) {
-  (void) tok; (void) file;
-  return * ret = a && b, 0;
+vec_eval(node_t * parent, env_t * prev, env_t * stack,
+         gc_t * gc, const char * file, obj_t * obj) {
+  int id = parent->val.i;
+  // a task must not store into vectors the caller may be reading
+  if (id == VEC_SET && gc->task) return 1;
+  obj_t args[3];
+  tok_t * toks[4] = {&parent->tok};
+  size_t roots = gc->vrlen, i = 0;
+  int err = 0;
+  for (node_t * node = parent->front->next; !err && node != NULL;
+       node = node->next, i++) {
+    toks[i + 1] = &node->tok;
+    err = eval(node, prev, stack, gc, file, &args[i]) ||
+          vec_check(id, i, args[i], &node->tok, gc, file);
+  }
+  gc->vrlen = roots;
+  return err || vec_apply(id, toks, args, gc, file, obj);
 }
 
+// runs the body of callee in its new frame env
 int
-or(int a, int b, tok_t * tok, const char * file, int * ret) {
-  (void) tok; (void) file;
-  return * ret = a || b, 0;
+call(node_t * callee, env_t * env, gc_t * gc, const char * file, obj_t * obj) {
+  * obj = OBJ_NIL;
+  int prof = opt.prof && !prof_enter(callee, file);
+  for (node_t * stmt = callee->front->next->next; stmt != NULL;
+       stmt = stmt->next)
+    if (eval(stmt, env, env, gc, file, obj)) {
+      if (prof) prof_leave();
+      return 1;
+    }
+  if (prof) prof_leave();
+  return 0;
 }
 
+// call() through the memo table of callee, keyed on the arguments as they
+// were before the body could redefine them
 int
-not(int a, int b, tok_t * tok, const char * file, int * ret) {
-  (void) b; (void) tok; (void) file;
-  return * ret = !a, 0;
+call_memo(node_t * callee, env_t * env, gc_t * gc, const char * file,
+          obj_t * obj) {
+  def_t * def = &callee->val.d;
+  obj_t key[MEMO_ARGS];
+  for (size_t i = 0; i < def->len; i++) key[i] = env->locs[def->args[i]].obj;
+  if (memo_get(def->memo, key, obj)) return 0;
+  if (call(callee, env, gc, file, obj)) return 1;
+  return memo_put(def->memo, key, obj);
 }
 
 int
 eval(node_t * parent, env_t * prev, env_t * stack,
      gc_t * gc, const char * file, obj_t * obj) {
   if (parent->type == NOD_INT) {
-    return obj->val.i = parent->val.i, obj->type = OBJ_INT, 0;
+    return * obj = mkint(parent->val.i), 0;
   } else if (parent->type == NOD_BOL) {
-    return obj->val.i = parent->val.i, obj->type = OBJ_BOL, 0;
+    return * obj = mkbol(parent->val.i), 0;
   } else if (parent->type == NOD_VAR) {
     return env_get(prev, &parent->val.v, obj), 0;
+  } else if (parent->type == NOD_QOP) {
+    if (!quick_eval(parent, prev, obj)) return 0;
+    return operate(parent, parent->val.q.op, prev, stack, gc, file, obj);
   } else if (parent->type == NOD_DEF) {
-    fun_init(&obj->val.f, parent, prev);
-    return obj->type = OBJ_FUN, 0;
+    // a task may not add to the closures of a shared env
+    if (prev->task != gc->task) return 1;
+    fun_t * fun = fun_get(parent, prev);
+    if (fun == NULL) return 1;
+    return * obj = mkfun(fun), 0;
   } else if (parent->type == NOD_FUN) {
     node_t * caller = parent->front;
     obj_t o;
     if (eval(caller, prev, stack, gc, file, &o)) return 1;
     tok_t * ctok = &caller->tok;
-    if (o.type != OBJ_FUN)
+    if (obj_type(o) != OBJ_FUN)
       return error(ctok, file, "variable is not function\n"), 1;
-    fun_t * fun = &o.val.f;
+    fun_t * fun = obj_f(o);
     node_t * callee = fun->node;
     def_t * def = &callee->val.d;
+    // a task gives up where sequential evaluation would have effects
+    if (gc->task && (!def->pure || def->scope != NULL ||
+                     __atomic_load_n(gc->cancel, __ATOMIC_RELAXED)))
+      return 1;
+    if (def->scope != NULL && resolve(callee, file)) return 1;
     size_t len = 0;
     for (node_t * arg = caller->next; arg != NULL; arg = arg->next) len++;
     tok_t * ptok = &parent->tok;
     if (len != def->len)
       return error(ptok, file, "parameters length do not match\n"), 1;
-    env_t * env = env_new(fun->env, stack, def->env);
+    env_t * env = gc_alloc(gc, fun->env, stack, def->env);
     if (env == NULL) return 1;
     if (gc_add(gc, env, &env->id)) return env_free(env), 1;
-    node_t * params = callee->front->next;
-    node_t * arg = caller->next;
-    for (size_t i = 0; i < def->len; i++, arg = arg->next) {
-      obj_t ret;
-      if (eval(arg, prev, env, gc, file, &ret)) return 1;
-      var_t var = {.env = 0, .off = def->args[i]};
-      env_set(env, &var, &ret);
+    if (gc->par != NULL && parent->val.i) {
+      if (par_args(parent, prev, env, def, gc, file)) return 1;
+    } else {
+      node_t * arg = caller->next;
+      for (size_t i = 0; i < def->len; i++, arg = arg->next) {
+        obj_t ret;
+        // variables and literals are read in place
+        if (arg->type == NOD_VAR) env_get(prev, &arg->val.v, &ret);
+        else if (arg->type == NOD_INT) ret = mkint(arg->val.i);
+        else if (eval(arg, prev, env, gc, file, &ret)) return 1;
+        var_t var = {.env = 0, .off = def->args[i]};
+        if (env_set(env, &var, &ret, gc)) return 1;
+      }
     }
-    obj->type = OBJ_NIL;
-    for (node_t * stmt = params->next; stmt != NULL; stmt = stmt->next)
-      if (eval(stmt, env, env, gc, file, obj)) return 1;
+    // tasks leave the tables alone, they are not shared safely
+    if (def->memo != NULL && !gc->task) {
+      if (call_memo(callee, env, gc, file, obj)) return 1;
+    } else {
+      if (call(callee, env, gc, file, obj)) return 1;
+    }
+    // a returned closure may be the last thing pointing at its env
+    env_t * keep = obj_type(* obj) == OBJ_FUN ? obj_f(* obj)->env : NULL;
+    return gc->rc && gc_unref(gc, env, keep);
+  } else if (parent->type == NOD_INL) {
+    // a task must not store into the frames it shares
+    if (prev->task != gc->task) return 1;
+    * obj = OBJ_NIL;
+    for (node_t * stmt = parent->front->next; stmt != NULL; stmt = stmt->next)
+      if (eval(stmt, prev, stack, gc, file, obj)) return 1;
     return 0;
   } else if (parent->type == NOD_SET) {
     node_t * name = parent->front->next;
     obj_t o;
     if (eval(name->next, prev, stack, gc, file, &o)) return 1;
-    env_set(prev, &name->val.v, &o);
-    return obj->type = OBJ_NIL, 0;
-  } else if (parent->type == NOD_IF) {
+    if (env_set(prev, &name->val.v, &o, gc)) return 1;
+    return * obj = OBJ_NIL, 0;
+  } else if (parent->type == NOD_IF || parent->type == NOD_QIF) {
     node_t * cond = parent->front->next;
     obj_t o;
-    if (eval(cond, prev, stack, gc, file, &o)) return 1;
+    if ((parent->type != NOD_QIF || quick_eval(cond, prev, &o)) &&
+        eval(cond, prev, stack, gc, file, &o)) return 1;
     tok_t * tok = &cond->tok;
-    if (o.type != OBJ_BOL)
+    if (obj_type(o) != OBJ_BOL)
       return error(tok, file, "variable is not boolean\n"), 1;
-    node_t * stmt = o.val.i ? cond->next : cond->next->next;
+    node_t * stmt = obj_i(o) ? cond->next : cond->next->next;
     if (eval(stmt, prev, stack, gc, file, obj)) return 1;
     tok_t * stok = &stmt->tok;
-    if (obj->type == OBJ_NIL)
+    if (* obj == OBJ_NIL)
       return error(stok, file,
                    "the return value of if-else statement is nil\n"), 1;
     return 0;
-  } else if (parent->type == NOD_LT) {
-    return calc(parent, prev, stack, gc, lt, OBJ_INT, OBJ_BOL, 0, file, obj);
-  } else if (parent->type == NOD_GT) {
-    return calc(parent, prev, stack, gc, gt, OBJ_INT, OBJ_BOL, 0, file, obj);
-  } else if (parent->type == NOD_EQ) {
-    return calc(parent, prev, stack, gc, eq, OBJ_INT, OBJ_BOL, 0, file, obj);
-  } else if (parent->type == NOD_ADD) {
-    return calc(parent, prev, stack, gc, add, OBJ_INT, OBJ_INT, 0, file, obj);
-  } else if (parent->type == NOD_SUB) {
-    return calc(parent, prev, stack, gc, sub, OBJ_INT, OBJ_INT, 0, file, obj);
-  } else if (parent->type == NOD_MUL) {
-    return calc(parent, prev, stack, gc, mul, OBJ_INT, OBJ_INT, 0, file, obj);
-  } else if (parent->type == NOD_DIV) {
-    return calc(parent, prev, stack, gc, idiv, OBJ_INT, OBJ_INT, 0, file, obj);
-  } else if (parent->type == NOD_MOD) {
-    return calc(parent, prev, stack, gc, mod, OBJ_INT, OBJ_INT, 0, file, obj);
-  } else if (parent->type == NOD_AND) {
-    return calc(parent, prev, stack, gc, and, OBJ_BOL, OBJ_BOL, 0, file, obj);
-  } else if (parent->type == NOD_OR) {
-    return calc(parent, prev, stack, gc, or, OBJ_BOL, OBJ_BOL, 0, file, obj);
-  } else if (parent->type == NOD_NOT) {
-    return calc(parent, prev, stack, gc, not, OBJ_BOL, OBJ_BOL, 1, file, obj);
+  } else if (parent->type == NOD_WHL) {
+    // runs in place, an iteration allocates no frame
+    node_t * cond = parent->front->next;
+    tok_t * tok = &cond->tok;
+    for (;;) {
+      obj_t o;
+      if (gc->task && __atomic_load_n(gc->cancel, __ATOMIC_RELAXED)) return 1;
+      if (eval(cond, prev, stack, gc, file, &o)) return 1;
+      if (obj_type(o) != OBJ_BOL)
+        return error(tok, file, "variable is not boolean\n"), 1;
+      if (!obj_i(o)) return * obj = OBJ_NIL, 0;
+      for (node_t * stmt = cond->next; stmt != NULL; stmt = stmt->next)
+        if (eval(stmt, prev, stack, gc, file, obj)) return 1;
+    }
+  } else if (parent->type >= NOD_LT && parent->type <= NOD_NOT) {
+    return operate(parent, parent->type, prev, stack, gc, file, obj);
   } else if (parent->type == NOD_PRN) {
+    if (gc->task) return 1;
     node_t * num = parent->front->next;
     obj_t o;
     if (eval(num, prev, stack, gc, file, &o)) return 1;
     tok_t * tok = &num->tok;
-    if (o.type != OBJ_INT)
+    if (obj_type(o) != OBJ_INT)
       return error(tok, file, "the argument of print-num is not integer\n"), 1;
-    printf("%d\n", o.val.i);
-    return obj->type = OBJ_NIL, 0;
+    printf("%d\n", obj_i(o));
+    return * obj = OBJ_NIL, 0;
   } else if (parent->type == NOD_PRB) {
+    if (gc->task) return 1;
     node_t * num = parent->front->next;
     obj_t o;
     if (eval(num, prev, stack, gc, file, &o)) return 1;
     tok_t * tok = &num->tok;
-    if (o.type != OBJ_BOL)
+    if (obj_type(o) != OBJ_BOL)
       return error(tok, file, "the argument of print-bool is not boolean\n"), 1;
-    printf("%s\n", o.val.i ? "#t" : "#f");
-    return obj->type = OBJ_NIL, 0;
+    printf("%s\n", obj_i(o) ? "#t" : "#f");
+    return * obj = OBJ_NIL, 0;
+  } else if (parent->type == NOD_VEC) {
+    return vec_eval(parent, prev, stack, gc, file, obj);
   } else {
     printf("? %d %p\n", parent->type, (void *) parent);
     return 1;
@@ -961,41 +983,59 @@ eval(node_t * parent, env_t * prev, env_t * stack,
 
 void
 pobj(obj_t * obj) {
-  if (obj->type == OBJ_NIL)
+  if (obj_type(* obj) == OBJ_NIL)
     printf("obj NIL\n");
-  else if (obj->type == OBJ_INT)
-    printf("obj %d NUM\n", obj->val.i);
-  else if (obj->type == OBJ_BOL)
-    printf("obj %s BOL\n", obj->val.i ? "true" : "false");
-  else if (obj->type == OBJ_FUN)
-    printf("obj %p FUN\n", (void *) obj->val.f.node);
+  else if (obj_type(* obj) == OBJ_INT)
+    printf("obj %d NUM\n", obj_i(* obj));
+  else if (obj_type(* obj) == OBJ_BOL)
+    printf("obj %s BOL\n", obj_i(* obj) ? "true" : "false");
+  else if (obj_type(* obj) == OBJ_FUN)
+    printf("obj %p FUN\n", (void *) obj_f(* obj)->node);
+  else if (obj_type(* obj) == OBJ_VEC)
+    printf("obj %p VEC\n", (void *) obj_v(* obj));
 }
 
+// parses str into parent and analyzes it, map ends up with the globals
 int
-run(const char * str, node_t * parent, map_t * map, env_t * env, gc_t * gc,
-    const char * file) {
-  const char * line = str;
-  size_t lnum = 0;
-  while (peek(str) != TOK_EOF)
-    if (parse(&str, parent, file, &line, &lnum)) return 1;
+analyze(const char * str, node_t * parent, map_t * map, const char * file) {
+  double t = stats_clock();
+  if (parse_par(&str, parent, file, opt.parse_threads)) return 1;
   //node_dump(parent);
+  t = stats_lap(PHA_PARSE, t);
   for (node_t * node = parent->front; node != NULL; node = node->next)
-    if (semantic(node, map, file) || env_add(env, map->len)) return 1;
+    if (semantic(node, map, file)) return 1;
+  if (opt.memo && memo_analyze(parent, map->len, file)) return 1;
+  if (opt.inl && inline_calls(parent, map->len)) return 1;
+  if (!opt.plain) quicken(parent->front);
   //node_dump(parent);
+  stats_lap(PHA_SEMANTIC, t);
+  return 0;
+}
+
+// evaluates the analyzed forms of parent in the global frame env
+int
+evaluate(node_t * parent, env_t * env, gc_t * gc, const char * file) {
+  double t = stats_clock();
   for (node_t * node = parent->front; node != NULL; node = node->next) {
     obj_t obj;
-    if (eval(node, env, env, gc, file, &obj)) return 1;
+    if (eval(node, env, env, gc, file, &obj)) return stats_lap(PHA_EVAL, t), 1;
     //pobj(&obj);
   }
+  stats_lap(PHA_EVAL, t);
   return 0;
 }
 
+int
+run(const char * str, node_t * parent, map_t * map, env_t * env, gc_t * gc,
+    const char * file) {
+  if (analyze(str, parent, map, file) || env_add(env, map->len)) return 1;
+  return evaluate(parent, env, gc, file);
+}
+
 int
 feed(const char * str, const char * file) {
   node_t * node = node_new(NULL, NOD_NIL);
   if (node == NULL) return 1;
-  tok_t * tok = &node->tok;
-  tok->lnum = 0;
   map_t map;
   map_init(&map, NULL);
   env_t * env = env_new(NULL, NULL, 0);
@@ -1003,27 +1043,56 @@ feed(const char * str, const char * file) {
   gc_t * gc = gc_new();
   if (gc == NULL) return env_free(env), 1;
   if (gc_add(gc, env, &env->id)) return gc_free(gc), env_free(env), 1;
-  if (run(str, node, &map, env, gc, file))
+  // the names of a snapshot come first, its tree outlives the run
+  struct snap * snap = NULL;
+  if (opt.snapshot != NULL &&
+      (snap = snap_load(opt.snapshot, &map, env, gc)) == NULL)
     return gc_free(gc), map_free(&map), node_free(node), 1;
+  int err = lines_add(NULL, str, strlen(str)) ||
+            run(str, node, &map, env, gc, file) ||
+            (opt.save != NULL && snap_save(opt.save, node, &map, env, str));
+  lines_drop(str);
+  if (err)
+    return gc_free(gc), map_free(&map), node_free(node), snap_free(snap), 1;
   gc_free(gc);
   map_free(&map);
   node_free(node);
+  snap_free(snap);
   return 0;
 }
 
+// the contents of file, NUL terminated, and their size
+char *
+slurp(FILE * file, size_t * size) {
+  if (fseek(file, 0, SEEK_END)) return NULL;
+  long lsize = ftell(file);
+  if (lsize == -1) return NULL;
+  * size = (size_t) lsize;
+  rewind(file);
+  char * str = malloc(* size + 1);
+  if (str == NULL) return NULL;
+  if (fread(str, 1, * size, file) != * size) return free(str), NULL;
+  str[* size] = '\0';
+  return str;
+}
+
+// fnv-1a of the size bytes at ptr, continued from h
+uint64_t
+fnv(uint64_t h, const void * ptr, size_t size) {
+  for (const unsigned char * p = ptr; size--; p++)
+    h = (h ^ * p) * 1099511628211u;
+  return h;
+}
+
 int
 exec(const char * path) {
+  double t = stats_clock();
   FILE * file = fopen(path, "rb");
   if (file == NULL) return 1;
-  if (fseek(file, 0, SEEK_END)) return fclose(file), 1;
-  long lsize = ftell(file);
-  if (lsize == -1) return fclose(file), 1;
-  size_t size = (size_t) lsize;
-  rewind(file);
-  char * str = malloc(size + 1);
+  size_t size;
+  char * str = slurp(file, &size);
   if (str == NULL) return fclose(file), 1;
-  if (fread(str, 1, size, file) != size) return free(str), fclose(file), 1;
-  str[size] = '\0';
+  stats_lap(PHA_READ, t);
   if (feed(str, path)) return free(str), fclose(file), 1;
   free(str);
   fclose(file);
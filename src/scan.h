@@ -1,6 +1,9 @@
 #ifndef SCAN_H
 #define SCAN_H
 
+#include <stdio.h>
+#include <stdint.h>
+
 #define TOK_NIL    0
 #define TOK_EOF    1
 #define TOK_NUM    2
@@ -33,31 +36,72 @@
 #define NOD_NOT 21
 #define NOD_PRN 22
 #define NOD_PRB 23
+#define NOD_VEC 24 // vector builtin, val.i holds its VEC_ id
+#define NOD_WHL 25
+#define NOD_QOP 26 // quickened binary operation, val.q holds it
+#define NOD_QIF 27 // if whose condition is a quickened comparison
+#define NOD_INL 28 // call replaced by the body of its callee, see inline.c
 
 #define OBJ_NIL 0
 #define OBJ_INT 1
 #define OBJ_BOL 2
 #define OBJ_FUN 3
+#define OBJ_VEC 4
+#define OBJ_TAG 7 // low bits of a value, heap objects are 8-byte aligned
+
+#define VEC_NEW 0
+#define VEC_REF 1
+#define VEC_SET 2
+#define VEC_LEN 3
+#define VEC_SUM 4
+#define VEC_ADD 5
+#define VEC_MUL 6
+#define VEC_MIN 7
+#define VEC_MAX 8
+#define VEC_EQ  9
+#define VEC_LT 10
+#define VEC_GT 11
 
 #define GC_NIL  0
 #define GC_MARK 1
 
+#define GC_IDLE    0
+#define GC_MARKING 1 // an incremental cycle is in progress
+#define GC_MIN     64 // envs tracked before an incremental cycle starts
+#define GC_YOUNG 4096 // young envs that trigger a minor collection
+
+#define GC_PAR_MIN 4096 // fewer envs than this are marked on one thread
+#define GC_VEC_MIN (1 << 20) // vector bytes that start a full cycle
+
+#define PARSE_PAR_MIN 65536 // shorter inputs are parsed on one thread
+
+#define INLINE_SIZE 24 // nodes in the largest body inlined at a call
+
+#define FNV_BASIS 14695981039346656037u // the first h of fnv()
+
+// where a token is in its source, the line is looked up on demand
 typedef struct {
   const char * begin;
-  const char * end;
-  const char * line;
-  size_t lnum;
+  uint32_t len;
   int id;
 } tok_t;
 
+#define tok_end(tok) ((tok)->begin + (tok)->len)
+
 typedef struct map {
   struct map * prev;
+  struct map * base; // the map this one is a truncated copy of, or itself
   const char ** begin;
   const char ** end;
   size_t len;
   size_t capa;
 } map_t;
 
+typedef struct {
+  map_t * map;
+  size_t len; // names of map visible at the point of definition
+} scope_t;
+
 typedef struct {
   size_t env;
   size_t off;
@@ -67,12 +111,29 @@ typedef struct {
   size_t * args;
   size_t len;
   size_t env;
+  scope_t * scope; // enclosing scopes while the body is unresolved
+  size_t depth;
+  map_t * map;     // names of a lazily resolved body
+  int pure;        // the body neither prints nor defines outside its frame
+  struct memo * memo; // results by arguments, if they depend on nothing else
 } def_t;
 
-typedef union {
-  int   i;
+typedef struct {
   var_t v;
-  def_t d;
+  int   i;
+  int   var; // read v, else the constant i
+} opnd_t;
+
+typedef struct {
+  opnd_t a, b;
+  int    op; // the node type it replaces
+} quick_t;
+
+typedef union {
+  int     i;
+  var_t   v;
+  def_t   d;
+  quick_t q;
 } nval_t;
 
 typedef struct env {
@@ -81,8 +142,20 @@ typedef struct env {
   struct loc * locs;
   size_t  len;
   size_t  id;
+  struct chunk * chunk; // nursery chunk holding env and locs, if any
+  char    rem;          // in the remembered set
+  char    task;         // tracked by the private heap of a parallel task
+  size_t  refs;         // prev links, stored closures and the activation
+  struct fun * funs;    // closures over this env, freed with it
 } env_t;
 
+typedef struct vec {
+  size_t  len;
+  char    mark;
+  char    task;  // allocated by a parallel task
+  int32_t data[];
+} vec_t;
+
 typedef struct addr {
   env_t * val;
   char    mark;
@@ -93,27 +166,78 @@ typedef struct {
   addr_t * addrs;
   size_t   capa;
   size_t   len;
+  env_t ** work; // mark worklist, never longer than len
+  size_t   wlen;
+  size_t   wcapa;
+  struct gc_pool * pool; // marking threads and sweeper, if any
+  int      phase;
+  size_t   next;  // len that starts the next incremental or full cycle
+  struct nursery * nursery; // bump allocator for young envs, if any
+  size_t   old;   // envs below this index are old
+  env_t ** rem;   // old envs that may point to young ones
+  size_t   rlen;
+  size_t   rcapa;
+  int      rc;    // free envs when their reference count drops to zero
+  size_t   budget; // slots scanned per incremental step, 0 stops the world
+  struct par_pool * par; // evaluates pure arguments in parallel, if any
+  char     task;  // private to a task, which may not print or call impure
+  int *    cancel; // set when the task's result is no longer wanted
+  vec_t ** vecs;  // every vector, swept by full cycles only
+  size_t   vlen;
+  size_t   vcapa;
+  vec_t ** vroots; // vectors held by builtins while operands are evaluated
+  size_t   vrlen;
+  size_t   vrcapa;
+  size_t   vbytes; // held by vecs
+  size_t   vnext;  // vbytes that start the next full cycle
 } gc_t;
 
-typedef struct {
+typedef struct fun {
   env_t * env;
   struct node * node;
+  struct fun * next; // in the funs of env
 } fun_t;
 
-typedef union {
-  int   i;
-  fun_t f;
-} val_t;
+// a value is one word: nil is 0, integers and booleans sit in the high
+// half, closures and vectors are pointers tagged in the low bits
+typedef uint64_t obj_t;
 
-typedef struct {
-  char  type;
-  val_t val;
-} obj_t;
+#define obj_type(o) ((int) ((o) & OBJ_TAG))
+#define obj_i(o)    ((int) (int32_t) (uint32_t) ((o) >> 32))
+#define obj_f(o)    ((fun_t *) (uintptr_t) ((o) & ~(obj_t) OBJ_TAG))
+#define obj_v(o)    ((vec_t *) (uintptr_t) ((o) & ~(obj_t) OBJ_TAG))
+#define mkint(i)    ((obj_t) (uint32_t) (i) << 32 | OBJ_INT)
+#define mkbol(b)    ((obj_t) (uint32_t) (b) << 32 | OBJ_BOL)
+#define mkfun(f)    ((obj_t) (uintptr_t) (f) | OBJ_FUN)
+#define mkvec(v)    ((obj_t) (uintptr_t) (v) | OBJ_VEC)
 
 typedef struct loc {
   obj_t obj;
 } loc_t; // local
 
+typedef struct {
+  int stats; // collect runtime statistics
+  int hw;    // with them, hardware events per phase
+  int prof;  // profile calls per function
+  size_t gc_threads; // marking threads, more than one enables the sweeper
+  size_t gc_budget;  // slots scanned per incremental step, 0 stops the world
+  int    gc_gen;     // allocate in a nursery and collect it separately
+  int    gc_rc;      // count references to envs, trace only for cycles
+  int    lazy;       // resolve function bodies when first evaluated
+  int    strict;     // resolve everything up front, overrides lazy
+  size_t parse_threads; // threads parsing top-level forms
+  size_t eval_threads;  // threads evaluating pure call arguments
+  int    memo;       // memoize functions of their arguments alone
+  int    plain;      // evaluate the tree as analyzed, without quickening
+  int    inl;        // inline small functions at their calls
+  const char * snapshot; // restore the globals from this file first
+  const char * save;     // write the globals to this file after the run
+  size_t mem_limit;      // bytes the interpreter may hold, 0 for no limit
+  const struct mem_ops * mem; // where they come from, malloc() if NULL
+} opt_t;
+
+extern opt_t opt;
+
 typedef struct node {
   struct node * parent;
   struct node * next;
@@ -126,30 +250,92 @@ typedef struct node {
 
 node_t * node_new(node_t * parent, int type);
 void node_dump(node_t * root);
+void node_add(node_t * node, node_t * child);
 void node_free(node_t * root);
 
 void map_init(map_t * map, map_t * prev);
 void map_free(map_t * map);
+int map_add(map_t * map, const char * begin, const char * end, var_t * var);
+int map_set(map_t * map, const char * begin, const char * end, var_t * var);
 
 env_t * env_new(env_t * ret, env_t * prev, size_t len);
 int env_add(env_t * env, size_t len);
+int env_set(env_t * env, var_t * var, obj_t * obj, gc_t * gc);
 void env_free(env_t * env);
+void env_release(env_t * env);
 
+gc_t * gc_plain(void);
 gc_t * gc_new(void);
 int gc_add(gc_t * gc, env_t * env, size_t * id);
+int gc_track(gc_t * gc, env_t * env, size_t * id);
 int gc_cleanup(gc_t * gc, env_t * prev, env_t * stack);
+void gc_push(gc_t * gc, env_t * env);
+int gc_shade(gc_t * gc, env_t * env, obj_t * obj);
 void gc_free(gc_t * gc);
 
-int scan(const char * str, const char ** begin, const char ** end,
+struct gc_pool * gc_pool_new(gc_t * gc, size_t threads);
+void gc_pool_free(struct gc_pool * pool);
+int gc_mark_par(gc_t * gc, env_t * prev, env_t * stack);
+void gc_dead(gc_t * gc, env_t * env);
+void gc_sweep(gc_t * gc);
+struct nursery * gc_nursery_new(void);
+void gc_nursery_free(struct nursery * nursery);
+env_t * gc_alloc(gc_t * gc, env_t * prev, env_t * ret, size_t len);
+void gc_chunk_release(struct chunk * chunk);
+int gc_remember(gc_t * gc, env_t * env);
+int gc_minor(gc_t * gc, env_t * prev, env_t * stack);
+size_t gc_compact(gc_t * gc, size_t from);
+vec_t * gc_vec(gc_t * gc, size_t len);
+int gc_protect(gc_t * gc, vec_t * vec);
+void gc_vec_sweep(gc_t * gc);
+int gc_unref(gc_t * gc, env_t * env, env_t * keep);
+void gc_drop_dead(gc_t * gc);
+
+struct par_pool * par_pool_new(size_t threads);
+void par_pool_free(struct par_pool * pool);
+int par_args(node_t * parent, env_t * prev, env_t * env, def_t * def,
+    gc_t * gc, const char * file);
+
+int vec_find(tok_t * tok, size_t * args);
+int vec_eval(node_t * parent, env_t * prev, env_t * stack,
+    gc_t * gc, const char * file, obj_t * obj);
+
+void quicken(node_t * node);
+int inline_calls(node_t * root, size_t globals);
+int quick_eval(node_t * node, env_t * env, obj_t * obj);
+
+int lines_add(const char * name, const char * str, size_t len);
+void lines_drop(const char * str);
+int lines_find(const char * at, const char ** name,
     const char ** line, size_t * lnum);
-int parse(const char ** str, node_t * parent,
-    const char * file, const char ** line, size_t * lnum);
+
+void error_begin(const char * str, const char * file);
+void error_end(const char * str);
+
+// a NULL file keeps quiet, parallel tasks leave their errors to the caller
+#define error(tok, file, ...) \
+    ((file) == NULL ? (void) 0 : \
+     (error_begin(tok->begin, file), \
+      (void) fprintf(stderr, __VA_ARGS__), \
+      error_end(tok->begin)))
+
+int scan(const char * str, const char ** begin, const char ** end);
+int parse(const char ** str, node_t * parent, const char * file);
+int parse_all(const char ** str, node_t * parent, const char * file);
+int parse_par(const char ** str, node_t * parent, const char * file,
+    size_t threads);
 int semantic(node_t * parent, map_t * prev, const char * file);
+int effects(node_t * node, int local);
+int spread(node_t * args);
 int eval(node_t * parent, env_t * prev, env_t * stack,
     gc_t * gc, const char * file, obj_t * obj);
+int analyze(const char * str, node_t * parent, map_t * map, const char * file);
+int evaluate(node_t * parent, env_t * env, gc_t * gc, const char * file);
 int run(const char * str, node_t * parent, map_t * map, env_t * env, gc_t * gc,
     const char * file);
 int feed(const char * str, const char * file);
+char * slurp(FILE * file, size_t * size);
+uint64_t fnv(uint64_t h, const void * ptr, size_t size);
 int exec(const char * path);
 
 #endif
@@ -0,0 +1,332 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "scan.h"
+#include "stats.h"
+#include "serve.h"
+
+// a request carries the client's stdout, stderr and working directory as
+// descriptors, then the name and, for a body, the script itself; the
+// reply is the exit status, the output goes straight to the client's fds
+typedef struct {
+  uint32_t body; // the script follows the name, else name is a path
+  uint32_t nlen;
+  uint64_t len;  // bytes of the script
+} req_t;
+
+#define REQ_FDS 3
+
+typedef struct {
+  uint64_t hash;
+  char *   str;  // the source, tokens point into it
+  size_t   len;
+  node_t * root;
+  map_t    map;  // the globals
+  size_t   used; // job that last ran it
+} prog_t;
+
+static prog_t * progs[SERVE_CACHE];
+static size_t jobs;
+static volatile sig_atomic_t quit;
+
+static int
+readn(int fd, void * buf, size_t len) {
+  for (char * p = buf; len;) {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return 1;
+    p += n, len -= (size_t) n;
+  }
+  return 0;
+}
+
+static int
+writen(int fd, const void * buf, size_t len) {
+  for (const char * p = buf; len;) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return 1;
+    p += n, len -= (size_t) n;
+  }
+  return 0;
+}
+
+static void
+prog_free(prog_t * prog) {
+  lines_drop(prog->str), node_free(prog->root), map_free(&prog->map);
+  free(prog->str), free(prog);
+}
+
+// the analyzed program of str, which it takes over, from the cache or
+// analyzed now in place of the program run longest ago
+static prog_t *
+compile(char * str, size_t len, const char * file) {
+  uint64_t h = fnv(FNV_BASIS, str, len);
+  size_t victim = 0;
+  for (size_t i = 0; i < SERVE_CACHE; i++) {
+    prog_t * prog = progs[i];
+    if (prog != NULL && prog->hash == h && prog->len == len &&
+        !memcmp(prog->str, str, len))
+      return free(str), prog->used = jobs, prog;
+    if (progs[victim] != NULL &&
+        (prog == NULL || prog->used < progs[victim]->used)) victim = i;
+  }
+  prog_t * prog = malloc(sizeof(* prog));
+  if (prog == NULL) return free(str), NULL;
+  if ((prog->root = node_new(NULL, NOD_NIL)) == NULL)
+    return free(str), free(prog), NULL;
+  prog->hash = h, prog->str = str, prog->len = len, prog->used = jobs;
+  map_init(&prog->map, NULL);
+  if (lines_add(NULL, str, len) ||
+      analyze(str, prog->root, &prog->map, file))
+    return prog_free(prog), NULL;
+  if (progs[victim] != NULL) prog_free(progs[victim]);
+  return progs[victim] = prog;
+}
+
+// runs str in fresh globals, memo tables hang off the tree and are freed
+// after every job, so those programs are analyzed each time
+static int
+job(char * str, size_t len, const char * file) {
+  jobs++;
+  if (opt.memo) {
+    int err = feed(str, file);
+    return free(str), err;
+  }
+  prog_t * prog = compile(str, len, file);
+  if (prog == NULL) return 1;
+  env_t * env = env_new(NULL, NULL, prog->map.len);
+  if (env == NULL) return 1;
+  gc_t * gc = gc_new();
+  if (gc == NULL) return env_free(env), 1;
+  if (gc_add(gc, env, &env->id)) return gc_free(gc), env_free(env), 1;
+  int err = evaluate(prog->root, env, gc, file);
+  return gc_free(gc), err;
+}
+
+// the request header and its descriptors
+static int
+receive(int conn, req_t * req, int * fds) {
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int) * REQ_FDS)];
+  } ctl;
+  struct iovec iov = {.iov_base = req, .iov_len = sizeof(* req)};
+  struct msghdr msg = {
+    .msg_iov = &iov, .msg_iovlen = 1,
+    .msg_control = ctl.buf, .msg_controllen = sizeof(ctl.buf)
+  };
+  ssize_t n;
+  while ((n = recvmsg(conn, &msg, 0)) < 0 && errno == EINTR);
+  if (n <= 0) return 1;
+  struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS) return 1;
+  unsigned char * data = CMSG_DATA(cmsg);
+  size_t nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+  if (nfds != REQ_FDS || n != (ssize_t) sizeof(* req) ||
+      req->nlen == 0 || req->nlen > SERVE_NAME) {
+    for (size_t i = 0; i < nfds; i++) {
+      int fd;
+      memcpy(&fd, data + i * sizeof(fd), sizeof(fd));
+      close(fd);
+    }
+    return 1;
+  }
+  return memcpy(fds, data, sizeof(int) * REQ_FDS), 0;
+}
+
+// the script of req, read from conn or opened relative to the client's
+// working directory
+static char *
+script(int conn, req_t * req, int cwd, const char * name, size_t * len) {
+  if (req->body) {
+    if (req->len > SIZE_MAX - 1) return NULL;
+    char * str = malloc((size_t) req->len + 1);
+    if (str == NULL) return NULL;
+    if (readn(conn, str, (size_t) req->len)) return free(str), NULL;
+    str[req->len] = '\0';
+    return * len = (size_t) req->len, str;
+  }
+  int fd = openat(cwd, name, O_RDONLY);
+  if (fd < 0) return NULL;
+  FILE * file = fdopen(fd, "rb");
+  if (file == NULL) return close(fd), NULL;
+  char * str = slurp(file, len);
+  return fclose(file), str;
+}
+
+// reads and runs the script of req, then the reports asked for
+static int
+request(int conn, req_t * req, int cwd, const char * name,
+        int (* done)(void)) {
+  stats_reset();
+  double t = stats_clock();
+  size_t len;
+  int status = 1;
+  char * str = script(conn, req, cwd, name, &len);
+  if (str != NULL) stats_lap(PHA_READ, t), status = job(str, len, name);
+  return done() || status;
+}
+
+// answers one request with the client's stdout and stderr in place of the
+// worker's own, out and err
+static void
+handle(int conn, int out, int err, int (* done)(void)) {
+  req_t req;
+  int fds[REQ_FDS];
+  if (receive(conn, &req, fds)) return;
+  char name[SERVE_NAME + 1];
+  int32_t status = 1;
+  if (!readn(conn, name, req.nlen)) {
+    name[req.nlen] = '\0';
+    fflush(stdout), fflush(stderr);
+    if (dup2(fds[0], 1) >= 0 && dup2(fds[1], 2) >= 0)
+      status = request(conn, &req, fds[2], name, done);
+    fflush(stdout), fflush(stderr);
+    dup2(out, 1), dup2(err, 2);
+  }
+  for (size_t i = 0; i < REQ_FDS; i++) close(fds[i]);
+  writen(conn, &status, sizeof(status));
+}
+
+static void
+worker(int sock, int (* done)(void)) {
+  signal(SIGINT, SIG_DFL), signal(SIGTERM, SIG_DFL);
+  // a client may leave before its output is written
+  signal(SIGPIPE, SIG_IGN);
+  int out = dup(1), err = dup(2);
+  if (out < 0 || err < 0) _exit(1);
+  for (;;) {
+    int conn = accept(sock, NULL, NULL);
+    if (conn < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      _exit(1);
+    }
+    handle(conn, out, err, done);
+    close(conn);
+  }
+}
+
+static void
+stop(int sig) {
+  (void) sig;
+  quit = 1;
+}
+
+// listens on the socket at path and keeps worker processes accepting on
+// it, replacing those that die, until interrupted
+int
+serve(const char * path, size_t workers, int (* done)(void)) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return fprintf(stderr, "%s: socket path is too long\n", path), 1;
+  strcpy(addr.sun_path, path);
+  if (!workers) workers = SERVE_WORKERS;
+  struct stat st;
+  // a stale socket from an earlier server is replaced, anything else kept
+  if (!stat(path, &st) && S_ISSOCK(st.st_mode)) unlink(path);
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) return perror("socket"), 1;
+  if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) ||
+      listen(sock, SOMAXCONN))
+    return perror(path), close(sock), 1;
+  pid_t * pids = calloc(workers, sizeof(* pids));
+  if (pids == NULL) return close(sock), unlink(path), 1;
+  struct sigaction sa = {.sa_handler = stop};
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL), sigaction(SIGTERM, &sa, NULL);
+  int ret = 0;
+  while (!quit) {
+    for (size_t i = 0; i < workers && !ret; i++) {
+      if (pids[i] > 0) continue;
+      fflush(stdout), fflush(stderr);
+      if ((pids[i] = fork()) == 0) worker(sock, done);
+      if (pids[i] < 0) ret = (perror("fork"), 1);
+    }
+    if (ret) break;
+    pid_t pid = waitpid(-1, NULL, 0);
+    for (size_t i = 0; i < workers; i++)
+      if (pid > 0 && pids[i] == pid) pids[i] = 0;
+  }
+  for (size_t i = 0; i < workers; i++)
+    if (pids[i] > 0) kill(pids[i], SIGTERM);
+  while (wait(NULL) > 0 || errno == EINTR);
+  unlink(path), close(sock), free(pids);
+  return ret;
+}
+
+// everything on in, which may not be seekable
+static char *
+drain(FILE * in, size_t * len) {
+  size_t capa = 4096;
+  char * str = malloc(capa);
+  if (str == NULL) return NULL;
+  * len = 0;
+  for (size_t n; (n = fread(str + * len, 1, capa - * len, in)) > 0;) {
+    if ((* len += n) < capa) continue;
+    char * ptr = realloc(str, capa *= 2);
+    if (ptr == NULL) return free(str), NULL;
+    str = ptr;
+  }
+  return ferror(in) ? (free(str), NULL) : str;
+}
+
+// runs file on the server at path as if by exec(), - reads the script
+// from stdin; the exit status is the script's
+int
+client(const char * path, const char * file) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return fprintf(stderr, "%s: socket path is too long\n", path), 1;
+  strcpy(addr.sun_path, path);
+  size_t nlen = strlen(file);
+  if (!nlen || nlen > SERVE_NAME)
+    return fprintf(stderr, "%s: name is too long\n", file), 1;
+  req_t req = {.body = !strcmp(file, "-"), .nlen = (uint32_t) nlen};
+  char * str = NULL;
+  if (req.body) {
+    size_t len;
+    if ((str = drain(stdin, &len)) == NULL) return perror(file), 1;
+    req.len = len;
+  }
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) return perror("socket"), free(str), 1;
+  if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)))
+    return perror(path), close(sock), free(str), 1;
+  int cwd = open(".", O_RDONLY | O_DIRECTORY);
+  if (cwd < 0) return perror("."), close(sock), free(str), 1;
+  int fds[REQ_FDS] = {1, 2, cwd};
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(fds))];
+  } ctl;
+  memset(&ctl, 0, sizeof(ctl));
+  struct iovec iov = {.iov_base = &req, .iov_len = sizeof(req)};
+  struct msghdr msg = {
+    .msg_iov = &iov, .msg_iovlen = 1,
+    .msg_control = ctl.buf, .msg_controllen = sizeof(ctl.buf)
+  };
+  struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET, cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  fflush(stdout), fflush(stderr);
+  int32_t status;
+  int err = sendmsg(sock, &msg, 0) != (ssize_t) sizeof(req) ||
+            writen(sock, file, nlen) ||
+            (str != NULL && writen(sock, str, (size_t) req.len)) ||
+            readn(sock, &status, sizeof(status));
+  close(cwd), close(sock), free(str);
+  if (err) return fprintf(stderr, "%s: no reply from the server\n", path), 1;
+  return status;
+}
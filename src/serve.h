@@ -0,0 +1,13 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stddef.h>
+
+#define SERVE_WORKERS 4  // worker processes when none are asked for
+#define SERVE_CACHE  64  // analyzed programs kept by each worker
+#define SERVE_NAME 4096  // longest script name a request may carry
+
+int serve(const char * path, size_t workers, int (* done)(void));
+int client(const char * path, const char * file);
+
+#endif
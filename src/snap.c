@@ -0,0 +1,635 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "scan.h"
+#include "snap.h"
+#include "mem.h"
+
+// a snapshot holds the source of a run, its tree, the global names and
+// every env, closure and vector reachable from the global env; pointers
+// are stored as indices and offsets into the source, and rebuilt on load
+// while the source itself is used in place from the mapped file
+
+#define NONE UINT64_MAX
+
+typedef struct {
+  char     magic[8];
+  uint64_t layout; // record sizes and version of the build that wrote it
+  uint64_t sum;    // fnv-1a of everything after the header
+  uint64_t src;    // bytes of source, padded to 8 in the file
+  uint64_t nodes;  // the first is the root
+  uint64_t args;
+  uint64_t names;
+  uint64_t envs;   // the first is the global env
+  uint64_t locs;
+  uint64_t funs;
+  uint64_t vecs;
+  uint64_t words;  // vector elements, the last section
+} head_t;
+
+typedef struct {
+  uint64_t parent, next, front, back; // node indices + 1, 0 for none
+  uint64_t begin, len;    // offset into the source and length
+  int64_t  type, id;
+  uint64_t args;   // index of the first parameter of a def
+  nval_t   val;    // a def without its pointers
+} rnode_t;
+
+typedef struct {
+  uint64_t begin, end;
+} rname_t;
+
+typedef struct {
+  uint64_t prev;   // env index + 1, 0 for none
+  uint64_t len;
+  uint64_t locs;   // index of the first value
+} renv_t;
+
+typedef struct {
+  uint64_t env, node;
+} rfun_t;
+
+typedef struct {
+  uint64_t len;
+  uint64_t words;  // index of the first element
+} rvec_t;
+
+struct snap {
+  void *   base;
+  size_t   size;
+  node_t * root;
+};
+
+static const char magic[8] = "lpsnap";
+
+static uint64_t
+layout(void) {
+  return (uint64_t) sizeof(rnode_t) << 32 | (uint64_t) sizeof(obj_t) << 24 |
+         (uint64_t) sizeof(nval_t) << 8 | SNAP_VERSION;
+}
+
+// pointers numbered in the order they are first seen
+typedef struct {
+  const void ** slots; // open addressing, capa a power of two
+  uint64_t *    idx;
+  size_t        capa;
+  const void ** list;  // by index
+  size_t        len;
+} ptab_t;
+
+static size_t
+slot(const ptab_t * t, const void * key) {
+  uint64_t h = (uint64_t) (uintptr_t) key * 11400714819323198485u;
+  return (size_t) (h >> 32) & (t->capa - 1);
+}
+
+static int
+intern(ptab_t * t, const void * key, uint64_t * at) {
+  if ((t->len + 1) * 2 > t->capa) {
+    size_t capa = t->capa ? t->capa * 2 : 64;
+    const void ** list = mem_realloc(MEM_SNAP, t->list,
+                                      sizeof(* list) * capa / 2);
+    if (list == NULL) return 1;
+    t->list = list;
+    mem_free(t->slots), mem_free(t->idx);
+    t->slots = mem_calloc(MEM_SNAP, capa, sizeof(* t->slots));
+    t->idx = mem_alloc(MEM_SNAP, sizeof(* t->idx) * capa);
+    if (t->slots == NULL || t->idx == NULL) return t->capa = 0, 1;
+    t->capa = capa;
+    for (size_t i = 0; i < t->len; i++) {
+      size_t s = slot(t, list[i]);
+      while (t->slots[s] != NULL) s = (s + 1) & (capa - 1);
+      t->slots[s] = list[i], t->idx[s] = i;
+    }
+  }
+  size_t s = slot(t, key);
+  for (; t->slots[s] != NULL; s = (s + 1) & (t->capa - 1))
+    if (t->slots[s] == key) return * at = t->idx[s], 0;
+  t->slots[s] = key, t->idx[s] = t->len, t->list[t->len] = key;
+  return * at = t->len++, 0;
+}
+
+static uint64_t
+lookup(const ptab_t * t, const void * key) {
+  if (!t->capa) return NONE;
+  size_t s = slot(t, key);
+  for (; t->slots[s] != NULL; s = (s + 1) & (t->capa - 1))
+    if (t->slots[s] == key) return t->idx[s];
+  return NONE;
+}
+
+static void
+ptab_free(ptab_t * t) {
+  mem_free(t->slots), mem_free(t->idx), mem_free(t->list);
+}
+
+static int
+number(ptab_t * nodes, node_t * node) {
+  for (uint64_t at; node != NULL; node = node->next)
+    if (intern(nodes, node, &at) || number(nodes, node->front)) return 1;
+  return 0;
+}
+
+// the closures, their envs and the vectors reachable from envs->list[0]
+static int
+reach(ptab_t * envs, ptab_t * funs, ptab_t * vecs) {
+  uint64_t at;
+  for (size_t i = 0; i < envs->len; i++) {
+    const env_t * env = envs->list[i];
+    if (env->prev != NULL && intern(envs, env->prev, &at)) return 1;
+    for (size_t j = 0; j < env->len; j++) {
+      obj_t obj = env->locs[j].obj;
+      if (obj_type(obj) == OBJ_VEC && intern(vecs, obj_v(obj), &at)) return 1;
+      if (obj_type(obj) != OBJ_FUN) continue;
+      fun_t * fun = obj_f(obj);
+      if (intern(funs, fun, &at) || intern(envs, fun->env, &at)) return 1;
+    }
+  }
+  return 0;
+}
+
+// whether node or anything below it is the code of a closure
+static int
+needed(const ptab_t * defs, const node_t * node) {
+  if (lookup(defs, node) != NONE) return 1;
+  for (node_t * n = node->front; n != NULL; n = n->next)
+    if (needed(defs, n)) return 1;
+  return 0;
+}
+
+// the top-level forms that hold the code of a closure, the rest of the
+// run is never evaluated again
+static int
+keep(ptab_t * nodes, const ptab_t * funs, node_t * root, const char * path) {
+  ptab_t defs = {0};
+  uint64_t at;
+  int err = intern(nodes, root, &at);
+  for (size_t i = 0; i < funs->len && !err; i++)
+    err = intern(&defs, ((const fun_t *) funs->list[i])->node, &at);
+  for (node_t * form = root->front; form != NULL && !err; form = form->next)
+    if (needed(&defs, form))
+      err = intern(nodes, form, &at) || number(nodes, form->front);
+  for (size_t i = 0; i < defs.len && !err; i++)
+    if (lookup(nodes, defs.list[i]) == NONE)
+      err = (fprintf(stderr, "%s: a closure is not part of the run\n",
+                     path), 1);
+  return ptab_free(&defs), err;
+}
+
+// node or the first kept node after it among its siblings
+static const node_t *
+kept(const ptab_t * nodes, const node_t * node) {
+  while (node != NULL && lookup(nodes, node) == NONE) node = node->next;
+  return node;
+}
+
+// tokens and names all point into the source
+static uint64_t
+offset(const char * ptr, const char * src, size_t len) {
+  uintptr_t p = (uintptr_t) ptr, s = (uintptr_t) src;
+  return p >= s && p - s <= len ? (uint64_t) (p - s) : 0;
+}
+
+static uint64_t
+ref(const ptab_t * nodes, const node_t * node) {
+  return node == NULL ? 0 : lookup(nodes, node) + 1;
+}
+
+static uint64_t
+encode(const ptab_t * funs, const ptab_t * vecs, obj_t obj) {
+  if (obj_type(obj) == OBJ_FUN) return lookup(funs, obj_f(obj)) << 3 | OBJ_FUN;
+  if (obj_type(obj) == OBJ_VEC) return lookup(vecs, obj_v(obj)) << 3 | OBJ_VEC;
+  return obj;
+}
+
+typedef struct {
+  FILE *   out;
+  uint64_t sum;
+} sink_t;
+
+static void
+put(sink_t * sink, const void * ptr, size_t size) {
+  sink->sum = fnv(sink->sum, ptr, size);
+  fwrite(ptr, 1, size, sink->out);
+}
+
+static int
+write_all(FILE * out, ptab_t * nodes, ptab_t * envs, ptab_t * funs,
+          ptab_t * vecs, map_t * map, const char * src, head_t * head) {
+  static const char pad[8];
+  size_t len = (size_t) head->src;
+  sink_t sink = {out, FNV_BASIS};
+  fwrite(head, sizeof(* head), 1, out);
+  // at least one NUL ends the last line of the source
+  put(&sink, src, len), put(&sink, pad, 8 - (len & 7));
+  uint64_t args = 0;
+  for (size_t i = 0; i < nodes->len; i++) {
+    const node_t * node = nodes->list[i];
+    rnode_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.parent = ref(nodes, node->parent);
+    rec.next = ref(nodes, kept(nodes, node->next));
+    rec.front = ref(nodes, kept(nodes, node->front));
+    rec.back = ref(nodes, node->back);
+    if (!i) {
+      rec.back = 0;
+      for (const node_t * n = rec.front ? node->front : NULL; n != NULL;
+           n = n->next)
+        if (lookup(nodes, n) != NONE) rec.back = ref(nodes, n);
+    } else {
+      rec.begin = offset(node->tok.begin, src, len);
+      rec.len = node->tok.len, rec.id = node->tok.id;
+    }
+    rec.type = node->type, rec.val = node->val;
+    if (node->type == NOD_DEF) {
+      rec.args = args, args += node->val.d.len;
+      rec.val.d.args = NULL, rec.val.d.scope = NULL;
+      rec.val.d.map = NULL, rec.val.d.memo = NULL;
+    }
+    put(&sink, &rec, sizeof(rec));
+  }
+  for (size_t i = 0; i < nodes->len; i++) {
+    const node_t * node = nodes->list[i];
+    if (node->type != NOD_DEF) continue;
+    for (size_t j = 0; j < node->val.d.len; j++) {
+      uint64_t arg = node->val.d.args[j];
+      put(&sink, &arg, sizeof(arg));
+    }
+  }
+  for (size_t i = 0; i < map->len; i++) {
+    rname_t rec = {offset(map->begin[i], src, len),
+                   offset(map->end[i], src, len)};
+    put(&sink, &rec, sizeof(rec));
+  }
+  uint64_t locs = 0;
+  for (size_t i = 0; i < envs->len; i++) {
+    const env_t * env = envs->list[i];
+    renv_t rec = {env->prev == NULL ? 0 : lookup(envs, env->prev) + 1,
+                  env->len, locs};
+    locs += env->len;
+    put(&sink, &rec, sizeof(rec));
+  }
+  for (size_t i = 0; i < envs->len; i++) {
+    const env_t * env = envs->list[i];
+    for (size_t j = 0; j < env->len; j++) {
+      uint64_t word = encode(funs, vecs, env->locs[j].obj);
+      put(&sink, &word, sizeof(word));
+    }
+  }
+  for (size_t i = 0; i < funs->len; i++) {
+    const fun_t * fun = funs->list[i];
+    rfun_t rec = {lookup(envs, fun->env), lookup(nodes, fun->node)};
+    put(&sink, &rec, sizeof(rec));
+  }
+  uint64_t words = 0;
+  for (size_t i = 0; i < vecs->len; i++) {
+    const vec_t * vec = vecs->list[i];
+    rvec_t rec = {vec->len, words};
+    words += vec->len;
+    put(&sink, &rec, sizeof(rec));
+  }
+  for (size_t i = 0; i < vecs->len; i++) {
+    const vec_t * vec = vecs->list[i];
+    put(&sink, vec->data, sizeof(* vec->data) * vec->len);
+  }
+  // the header goes in again with the sum
+  head->sum = sink.sum;
+  if (fseek(out, 0, SEEK_SET)) return 1;
+  fwrite(head, sizeof(* head), 1, out);
+  return ferror(out);
+}
+
+// writes the tree under root, parsed from src, and the globals map names
+// in env with everything they reach to path
+int
+snap_save(const char * path, node_t * root, map_t * map, env_t * env,
+          const char * src) {
+  ptab_t nodes = {0}, envs = {0}, funs = {0}, vecs = {0};
+  head_t head = {.layout = layout(), .src = strlen(src), .names = map->len};
+  memcpy(head.magic, magic, sizeof(magic));
+  uint64_t at;
+  int err = intern(&envs, env, &at) || reach(&envs, &funs, &vecs) ||
+            keep(&nodes, &funs, root, path);
+  FILE * out = NULL;
+  if (!err) {
+    for (size_t i = 0; i < nodes.len; i++) {
+      const node_t * node = nodes.list[i];
+      if (node->type == NOD_DEF) head.args += node->val.d.len;
+    }
+    for (size_t i = 0; i < envs.len; i++)
+      head.locs += ((const env_t *) envs.list[i])->len;
+    for (size_t i = 0; i < vecs.len; i++)
+      head.words += ((const vec_t *) vecs.list[i])->len;
+    head.nodes = nodes.len, head.envs = envs.len;
+    head.funs = funs.len, head.vecs = vecs.len;
+    if ((out = fopen(path, "wb")) == NULL) err = (perror(path), 1);
+  }
+  if (!err) {
+    err = write_all(out, &nodes, &envs, &funs, &vecs, map, src, &head);
+    if (fclose(out) || err) err = (perror(path), 1);
+  }
+  ptab_free(&nodes), ptab_free(&envs), ptab_free(&funs), ptab_free(&vecs);
+  return err;
+}
+
+// the next section of count records of size bytes, NULL past the end
+static const void *
+section(struct snap * snap, size_t * off, uint64_t count, size_t size) {
+  if (count > (snap->size - * off) / size) return NULL;
+  const void * ptr = (const char *) snap->base + * off;
+  return * off += (size_t) count * size, ptr;
+}
+
+static int
+bad(const char * path) {
+  return fprintf(stderr, "%s: not a snapshot of this build\n", path), 1;
+}
+
+// checks every index of the records before anything is built
+static int
+valid(const head_t * head, const rnode_t * rnodes, const rname_t * rnames,
+      const renv_t * renvs, const uint64_t * locs, const rfun_t * rfuns,
+      const rvec_t * rvecs) {
+  if (!head->nodes || !head->envs) return 0;
+  for (uint64_t i = 0; i < head->nodes; i++) {
+    const rnode_t * r = &rnodes[i];
+    if (r->parent > head->nodes || r->next > head->nodes ||
+        r->front > head->nodes || r->back > head->nodes ||
+        r->type < 0 || r->type > NOD_INL) return 0;
+    if (i && (r->begin > head->src || r->len > head->src - r->begin ||
+              r->len > UINT32_MAX)) return 0;
+    if (r->type == NOD_DEF && (r->args > head->args ||
+                               r->val.d.len > head->args - r->args))
+      return 0;
+  }
+  for (uint64_t i = 0; i < head->names; i++)
+    if (rnames[i].begin > rnames[i].end || rnames[i].end > head->src)
+      return 0;
+  for (uint64_t i = 0; i < head->envs; i++)
+    if (renvs[i].prev > head->envs || renvs[i].locs > head->locs ||
+        renvs[i].len > head->locs - renvs[i].locs) return 0;
+  for (uint64_t i = 0; i < head->locs; i++) {
+    uint64_t word = locs[i];
+    int type = obj_type(word);
+    if ((type == OBJ_FUN && word >> 3 >= head->funs) ||
+        (type == OBJ_VEC && word >> 3 >= head->vecs) || type > OBJ_VEC)
+      return 0;
+  }
+  for (uint64_t i = 0; i < head->funs; i++)
+    if (rfuns[i].env >= head->envs || rfuns[i].node >= head->nodes ||
+        rnodes[rfuns[i].node].type != NOD_DEF) return 0;
+  for (uint64_t i = 0; i < head->vecs; i++)
+    if (rvecs[i].words > head->words ||
+        rvecs[i].len > head->words - rvecs[i].words) return 0;
+  return 1;
+}
+
+// the nodes by index, linked into the tree of the first
+static node_t **
+build(const head_t * head, const rnode_t * rnodes, const uint64_t * args,
+      const char * src) {
+  node_t ** nodes = mem_calloc(MEM_SNAP, (size_t) head->nodes,
+                                sizeof(* nodes));
+  if (nodes == NULL) return NULL;
+  for (size_t i = 0; i < head->nodes; i++) {
+    const rnode_t * r = &rnodes[i];
+    node_t * node = nodes[i] = mem_alloc(MEM_AST, sizeof(* node));
+    size_t * as = NULL;
+    if (node != NULL && r->type == NOD_DEF) {
+      as = mem_alloc(MEM_AST, sizeof(* as) * (size_t) r->val.d.len + 1);
+      if (as == NULL) mem_free(node), node = nodes[i] = NULL;
+    }
+    if (node == NULL) {
+      while (i--) {
+        if (nodes[i]->type == NOD_DEF) mem_free(nodes[i]->val.d.args);
+        mem_free(nodes[i]);
+      }
+      return mem_free(nodes), NULL;
+    }
+    node->type = (int) r->type, node->val = r->val;
+    if (r->type == NOD_DEF) {
+      for (size_t j = 0; j < r->val.d.len; j++)
+        as[j] = (size_t) args[r->args + j];
+      node->val.d.args = as, node->val.d.scope = NULL;
+      node->val.d.map = NULL, node->val.d.memo = NULL;
+    }
+    if (!i) {
+      node->tok = (tok_t) {src, 0, 0};
+    } else {
+      node->tok = (tok_t) {src + r->begin, (uint32_t) r->len, (int) r->id};
+    }
+  }
+  for (size_t i = 0; i < head->nodes; i++) {
+    const rnode_t * r = &rnodes[i];
+    node_t * node = nodes[i];
+    node->parent = r->parent ? nodes[r->parent - 1] : NULL;
+    node->next = r->next ? nodes[r->next - 1] : NULL;
+    node->front = r->front ? nodes[r->front - 1] : NULL;
+    node->back = r->back ? nodes[r->back - 1] : NULL;
+  }
+  return nodes;
+}
+
+// the envs, closures and vectors, with env standing in for the global env
+static int
+restore(const head_t * head, const renv_t * renvs, const uint64_t * locs,
+        const rfun_t * rfuns, const rvec_t * rvecs, const int32_t * words,
+        node_t ** nodes, env_t * env, gc_t * gc) {
+  env_t ** envs = mem_calloc(MEM_SNAP, (size_t) head->envs, sizeof(* envs));
+  fun_t ** funs = mem_calloc(MEM_SNAP, (size_t) head->funs + 1,
+                             sizeof(* funs));
+  vec_t ** vecs = mem_calloc(MEM_SNAP, (size_t) head->vecs + 1,
+                             sizeof(* vecs));
+  int err = envs == NULL || funs == NULL || vecs == NULL ||
+            env_add(env, (size_t) renvs[0].len);
+  if (!err) envs[0] = env;
+  // built envs are tracked at once and freed with the collector on error
+  for (size_t i = 1; i < head->envs && !err; i++) {
+    if ((envs[i] = env_new(NULL, NULL, (size_t) renvs[i].len)) == NULL)
+      err = 1;
+    else if (gc_track(gc, envs[i], &envs[i]->id))
+      env_free(envs[i]), err = 1;
+  }
+  for (size_t i = 0; i < head->funs && !err; i++) {
+    fun_t * fun = funs[i] = mem_alloc(MEM_ENV, sizeof(* fun));
+    if (fun == NULL) { err = 1; break; }
+    fun->env = envs[rfuns[i].env], fun->node = nodes[rfuns[i].node];
+    fun->next = fun->env->funs, fun->env->funs = fun;
+  }
+  for (size_t i = 0; i < head->vecs && !err; i++) {
+    if ((vecs[i] = gc_vec(gc, (size_t) rvecs[i].len)) == NULL) {
+      err = 1;
+      break;
+    }
+    memcpy(vecs[i]->data, words + rvecs[i].words,
+           sizeof(* words) * (size_t) rvecs[i].len);
+  }
+  for (size_t i = 0; i < head->envs && !err; i++) {
+    env_t * e = envs[i];
+    e->prev = renvs[i].prev ? envs[renvs[i].prev - 1] : NULL;
+    e->refs = !i; // the activation of the global env
+    for (size_t j = 0; j < e->len; j++) {
+      uint64_t word = locs[renvs[i].locs + j];
+      if (obj_type(word) == OBJ_FUN) word = mkfun(funs[word >> 3]);
+      else if (obj_type(word) == OBJ_VEC) word = mkvec(vecs[word >> 3]);
+      e->locs[j].obj = word;
+    }
+  }
+  // prev links and stored closures, as --gc-rc counts them
+  for (size_t i = 0; i < head->envs && !err; i++) {
+    env_t * e = envs[i];
+    if (e->prev != NULL) e->prev->refs++;
+    for (size_t j = 0; j < e->len; j++) {
+      obj_t obj = e->locs[j].obj;
+      if (obj_type(obj) == OBJ_FUN) obj_f(obj)->env->refs++;
+    }
+  }
+  // restored envs are old, nothing young exists yet
+  if (!err && gc->nursery != NULL) gc->old = gc->len;
+  return mem_free(envs), mem_free(funs), mem_free(vecs), err;
+}
+
+// maps the snapshot at path, names its globals in map and restores them
+// into env; the tree it holds lives until snap_free()
+struct snap *
+snap_load(const char * path, map_t * map, env_t * env, gc_t * gc) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return perror(path), NULL;
+  struct stat st;
+  if (fstat(fd, &st)) return perror(path), close(fd), NULL;
+  struct snap * snap = mem_alloc(MEM_SNAP, sizeof(* snap));
+  if (snap == NULL) return close(fd), NULL;
+  snap->size = (size_t) st.st_size, snap->root = NULL;
+  if (snap->size < sizeof(head_t))
+    return bad(path), close(fd), mem_free(snap), NULL;
+  snap->base = mmap(NULL, snap->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (snap->base == MAP_FAILED) return perror(path), mem_free(snap), NULL;
+  head_t head;
+  memcpy(&head, snap->base, sizeof(head));
+  size_t off = sizeof(head);
+  const char * src = head.src < snap->size ?
+                     section(snap, &off, (head.src + 8) & ~(uint64_t) 7, 1) :
+                     NULL;
+  const rnode_t * rnodes = section(snap, &off, head.nodes, sizeof(rnode_t));
+  const uint64_t * args = section(snap, &off, head.args, sizeof(uint64_t));
+  const rname_t * rnames = section(snap, &off, head.names, sizeof(rname_t));
+  const renv_t * renvs = section(snap, &off, head.envs, sizeof(renv_t));
+  const uint64_t * locs = section(snap, &off, head.locs, sizeof(uint64_t));
+  const rfun_t * rfuns = section(snap, &off, head.funs, sizeof(rfun_t));
+  const rvec_t * rvecs = section(snap, &off, head.vecs, sizeof(rvec_t));
+  const int32_t * words = section(snap, &off, head.words, sizeof(int32_t));
+  const char * rest = (const char *) snap->base + sizeof(head);
+  if (memcmp(head.magic, magic, sizeof(magic)) || head.layout != layout() ||
+      head.sum != fnv(FNV_BASIS, rest, snap->size - sizeof(head)) ||
+      src == NULL || rnodes == NULL || args == NULL || rnames == NULL ||
+      renvs == NULL || locs == NULL || rfuns == NULL || rvecs == NULL ||
+      words == NULL || off != snap->size ||
+      !valid(&head, rnodes, rnames, renvs, locs, rfuns, rvecs))
+    return bad(path), snap_free(snap), NULL;
+  // errors in the code it holds are reported against the snapshot
+  if (lines_add(path, src, (size_t) head.src)) return snap_free(snap), NULL;
+  for (size_t i = 0; i < head.names; i++) {
+    var_t var;
+    if (map_set(map, src + rnames[i].begin, src + rnames[i].end, &var) ||
+        var.off != i) return bad(path), snap_free(snap), NULL;
+  }
+  node_t ** nodes = build(&head, rnodes, args, src);
+  if (nodes == NULL) return snap_free(snap), NULL;
+  snap->root = nodes[0];
+  if (restore(&head, renvs, locs, rfuns, rvecs, words, nodes, env, gc))
+    return mem_free(nodes), snap_free(snap), NULL;
+  return mem_free(nodes), snap;
+}
+
+void
+snap_free(struct snap * snap) {
+  if (snap == NULL) return;
+  lines_drop((const char *) snap->base + sizeof(head_t));
+  if (snap->root != NULL) node_free(snap->root);
+  munmap(snap->base, snap->size);
+  mem_free(snap);
+}
+
+// globals kept in memory, laid out like the records of a file but with
+// the code of the closures by pointer: funs[i].node indexes nodes
+struct ckpt {
+  head_t     head;
+  renv_t *   envs;
+  uint64_t * locs;
+  rfun_t *   funs;
+  node_t **  nodes;
+  rvec_t *   vecs;
+  int32_t *  words;
+};
+
+// a copy of the globals in env and everything they reach, which stays
+// valid whatever runs after it, as long as the tree of the closures lives
+struct ckpt *
+snap_take(env_t * env) {
+  ptab_t envs = {0}, funs = {0}, vecs = {0};
+  struct ckpt * ckpt = mem_calloc(MEM_SNAP, 1, sizeof(* ckpt));
+  uint64_t at;
+  if (ckpt == NULL) return NULL;
+  head_t * head = &ckpt->head;
+  int err = intern(&envs, env, &at) || reach(&envs, &funs, &vecs);
+  if (!err) {
+    for (size_t i = 0; i < envs.len; i++)
+      head->locs += ((const env_t *) envs.list[i])->len;
+    for (size_t i = 0; i < vecs.len; i++)
+      head->words += ((const vec_t *) vecs.list[i])->len;
+    head->envs = envs.len, head->funs = funs.len, head->vecs = vecs.len;
+    // one more of each, none may be empty
+    ckpt->envs = mem_alloc(MEM_SNAP, sizeof(* ckpt->envs) * (envs.len + 1));
+    ckpt->locs = mem_alloc(MEM_SNAP, sizeof(* ckpt->locs) *
+                           ((size_t) head->locs + 1));
+    ckpt->funs = mem_alloc(MEM_SNAP, sizeof(* ckpt->funs) * (funs.len + 1));
+    ckpt->nodes = mem_alloc(MEM_SNAP, sizeof(* ckpt->nodes) * (funs.len + 1));
+    ckpt->vecs = mem_alloc(MEM_SNAP, sizeof(* ckpt->vecs) * (vecs.len + 1));
+    ckpt->words = mem_alloc(MEM_SNAP, sizeof(* ckpt->words) *
+                            ((size_t) head->words + 1));
+    err = ckpt->envs == NULL || ckpt->locs == NULL || ckpt->funs == NULL ||
+          ckpt->nodes == NULL || ckpt->vecs == NULL || ckpt->words == NULL;
+  }
+  uint64_t locs = 0, words = 0;
+  for (size_t i = 0; i < envs.len && !err; i++) {
+    const env_t * e = envs.list[i];
+    ckpt->envs[i] = (renv_t) {e->prev == NULL ? 0 :
+                              lookup(&envs, e->prev) + 1, e->len, locs};
+    for (size_t j = 0; j < e->len; j++)
+      ckpt->locs[locs++] = encode(&funs, &vecs, e->locs[j].obj);
+  }
+  for (size_t i = 0; i < funs.len && !err; i++) {
+    const fun_t * fun = funs.list[i];
+    ckpt->funs[i] = (rfun_t) {lookup(&envs, fun->env), i};
+    ckpt->nodes[i] = fun->node;
+  }
+  for (size_t i = 0; i < vecs.len && !err; i++) {
+    const vec_t * vec = vecs.list[i];
+    ckpt->vecs[i] = (rvec_t) {vec->len, words};
+    memcpy(ckpt->words + words, vec->data, sizeof(* vec->data) * vec->len);
+    words += vec->len;
+  }
+  ptab_free(&envs), ptab_free(&funs), ptab_free(&vecs);
+  if (err) return snap_drop(ckpt), NULL;
+  return ckpt;
+}
+
+// restores the globals of ckpt into env, which holds none yet
+int
+snap_put(const struct ckpt * ckpt, env_t * env, gc_t * gc) {
+  return restore(&ckpt->head, ckpt->envs, ckpt->locs, ckpt->funs, ckpt->vecs,
+                 ckpt->words, ckpt->nodes, env, gc);
+}
+
+void
+snap_drop(struct ckpt * ckpt) {
+  if (ckpt == NULL) return;
+  mem_free(ckpt->envs), mem_free(ckpt->locs), mem_free(ckpt->funs);
+  mem_free(ckpt->nodes), mem_free(ckpt->vecs), mem_free(ckpt->words);
+  mem_free(ckpt);
+}
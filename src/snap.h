@@ -0,0 +1,18 @@
+#ifndef SNAP_H
+#define SNAP_H
+
+#include "scan.h"
+
+#define SNAP_VERSION 2 // bumped whenever the file layout changes
+
+struct snap * snap_load(const char * path, map_t * map, env_t * env,
+    gc_t * gc);
+int snap_save(const char * path, node_t * root, map_t * map, env_t * env,
+    const char * src);
+void snap_free(struct snap * snap);
+
+struct ckpt * snap_take(env_t * env);
+int snap_put(const struct ckpt * ckpt, env_t * env, gc_t * gc);
+void snap_drop(struct ckpt * ckpt);
+
+#endif
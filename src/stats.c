@@ -0,0 +1,155 @@
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include <string.h>
+#include "scan.h"
+#include "stats.h"
+#include "mem.h"
+
+stats_t stats;
+__thread int stats_quiet;
+
+#define MARKS 4 // laps that may be open at once, eval around a gc pause
+
+// the hardware counters at the clock readings laps begin from; marks taken
+// by stats_clock() are open until their lap ends, the ends of laps are
+// kept too for the lap chained after them, but are the first to go
+typedef struct {
+  double at;
+  int open;
+  size_t hw[PMU_LEN];
+} mark_t;
+
+static mark_t marks[MARKS];
+
+void
+stats_reset(void) {
+  stats = (stats_t) {0};
+  mem_reset();
+}
+
+const stats_t *
+stats_get(void) {
+  return &stats;
+}
+
+// seconds, read whatever the options
+double
+stats_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// the mark to take over, a closed one before the oldest open one
+static mark_t *
+spare(void) {
+  mark_t * m = &marks[0];
+  for (int i = 1; i < MARKS; i++)
+    if (marks[i].open < m->open ||
+        (marks[i].open == m->open && marks[i].at < m->at)) m = &marks[i];
+  return m;
+}
+
+// adds the events since the mark at begin to phase, then marks end there
+static void
+count(int phase, double begin, double end) {
+  size_t hw[PMU_LEN];
+  if (pmu_read(hw)) return;
+  mark_t * m = NULL;
+  for (int i = 0; i < MARKS && m == NULL; i++)
+    if (marks[i].at == begin) m = &marks[i];
+  if (m != NULL)
+    for (int i = 0; i < PMU_LEN; i++) stats.hw[phase][i] += hw[i] - m->hw[i];
+  else m = spare();
+  m->at = end, m->open = 0;
+  memcpy(m->hw, hw, sizeof(hw));
+}
+
+double
+stats_clock(void) {
+  if (!opt.stats) return 0;
+  double t = stats_now();
+  if (!opt.hw) return t;
+  mark_t * m = spare();
+  if (!pmu_read(m->hw)) m->at = t, m->open = 1;
+  return t;
+}
+
+double
+stats_lap(int phase, double begin) {
+  if (!opt.stats) return 0;
+  double end = stats_now();
+  if (opt.hw) count(phase, begin, end);
+  return stats.time[phase] += end - begin, end;
+}
+
+void
+stats_pause(double pause) {
+  size_t i = 0;
+  for (double us = pause * 1e6; us >= 1 && i < STATS_HIST - 1; us /= 2) i++;
+  stats.gc_pauses++, stats.gc_hist[i]++;
+  if (pause > stats.gc_pause_max) stats.gc_pause_max = pause;
+}
+
+// upper bound of the q-quantile pause, in seconds
+double
+stats_quantile(double q) {
+  size_t rank = (size_t) (q * (double) stats.gc_pauses + 0.5), sum = 0;
+  for (size_t i = 0; i < STATS_HIST; i++)
+    if ((sum += stats.gc_hist[i]) >= rank && sum)
+      return (double) (1ul << i) / 1e6;
+  return 0;
+}
+
+// events of the interpreter thread per phase, gc is part of eval again
+static void
+hw_dump(FILE * out, const char ** names) {
+  const char * why = pmu_error();
+  if (why != NULL) {
+    fprintf(out, "  hw counters:   unavailable (%s)\n", why);
+    return;
+  }
+  fprintf(out, "  hw %-9s", "");
+  for (int j = 0; j < PMU_LEN; j++) fprintf(out, " %10s", pmu_name(j));
+  fprintf(out, " %6s\n", "ipc");
+  for (int i = 0; i < PHA_LEN; i++) {
+    size_t * hw = stats.hw[i];
+    fprintf(out, "  hw %-9s", names[i]);
+    for (int j = 0; j < PMU_LEN; j++)
+      if (pmu_has(j)) fprintf(out, " %10zu", hw[j]);
+      else fprintf(out, " %10s", "n/a");
+    if (pmu_has(PMU_CYCLES) && pmu_has(PMU_INSTRS) && hw[PMU_CYCLES])
+      fprintf(out, " %6.2f\n",
+              (double) hw[PMU_INSTRS] / (double) hw[PMU_CYCLES]);
+    else fprintf(out, " %6s\n", "n/a");
+  }
+}
+
+void
+stats_dump(FILE * out) {
+  static const char * names[] = {"read", "parse", "semantic", "eval", "gc"};
+  fprintf(out, "--- stats ---\n");
+  fprintf(out, "  tokens:        %zu\n", stats.toks);
+  fprintf(out, "  nodes:         %zu\n", stats.nodes);
+  fprintf(out, "  defs lazy:     %zu (%zu resolved)\n",
+          stats.defs_lazy, stats.defs_resolved);
+  fprintf(out, "  quickened:     %zu\n", stats.nodes_quick);
+  fprintf(out, "  inlined:       %zu\n", stats.calls_inlined);
+  fprintf(out, "  envs new:      %zu\n", stats.envs_new);
+  fprintf(out, "  envs free:     %zu\n", stats.envs_free);
+  fprintf(out, "  envs peak:     %zu\n", stats.envs_peak);
+  fprintf(out, "  gc cycles:     %zu (%zu minor)\n",
+          stats.gc_cycles, stats.gc_minor);
+  fprintf(out, "  gc marked:     %zu (max %zu, avg %.1f per cycle)\n",
+          stats.gc_marked, stats.gc_marked_max, stats.gc_cycles ?
+          (double) stats.gc_marked / (double) stats.gc_cycles : 0.0);
+  fprintf(out, "  gc pause:      %.3f ms in %zu pauses (max %.3f ms)\n",
+          stats.time[PHA_GC] * 1e3, stats.gc_pauses, stats.gc_pause_max * 1e3);
+  fprintf(out, "  gc pause p50:  <= %.3f ms\n", stats_quantile(0.5) * 1e3);
+  fprintf(out, "  gc pause p99:  <= %.3f ms\n", stats_quantile(0.99) * 1e3);
+  for (int i = 0; i < PHA_LEN; i++)
+    fprintf(out, "  time %-9s %.3f ms\n", names[i], stats.time[i] * 1e3);
+  if (opt.hw) hw_dump(out, names);
+  mem_dump(out);
+  fprintf(out, "-------------\n");
+}
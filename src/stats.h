@@ -0,0 +1,53 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include "pmu.h"
+
+#define PHA_READ     0
+#define PHA_PARSE    1
+#define PHA_SEMANTIC 2
+#define PHA_EVAL     3
+#define PHA_GC       4
+#define PHA_LEN      5
+
+#define STATS_HIST 32 // pause buckets, bucket i holds pauses below 2^i us
+
+typedef struct {
+  size_t toks;          // tokens consumed by the parser
+  size_t nodes;         // syntax nodes created
+  size_t defs_lazy;     // function bodies left unresolved by semantic()
+  size_t defs_resolved; // of which were resolved on first use
+  size_t nodes_quick;   // nodes rewritten by quicken()
+  size_t calls_inlined; // calls replaced by the callee's body
+  size_t envs_new;      // environments allocated
+  size_t envs_free;     // environments freed
+  size_t envs_peak;     // most environments alive at once
+  size_t gc_cycles;     // collections
+  size_t gc_minor;      // of which only collected the nursery
+  size_t gc_marked;     // environments marked, summed over cycles
+  size_t gc_marked_max; // most environments marked in one cycle
+  size_t gc_pauses;     // stop-the-world collections or incremental steps
+  double gc_pause_max;  // longest pause, in seconds
+  size_t gc_hist[STATS_HIST];
+  double time[PHA_LEN]; // wall time per phase in seconds, gc is part of eval
+  size_t hw[PHA_LEN][PMU_LEN]; // hardware events per phase, with opt.hw
+} stats_t;
+
+extern stats_t stats;
+extern __thread int stats_quiet; // the thread leaves the counters alone
+
+// counters are only touched when opt.stats is set, from loud threads
+#define STATS(...) \
+  do { if (opt.stats && !stats_quiet) { __VA_ARGS__; } } while (0)
+
+void stats_reset(void);
+const stats_t * stats_get(void);
+double stats_now(void);
+double stats_clock(void);
+double stats_lap(int phase, double begin);
+void stats_pause(double pause);
+double stats_quantile(double q);
+void stats_dump(FILE * out);
+
+#endif
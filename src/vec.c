@@ -0,0 +1,337 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+#include "rt.h"
+
+// avx2 kernels are compiled for the target attribute and picked at runtime
+#if defined(__SSE2__) && defined(__GNUC__) && defined(__x86_64__)
+#define VEC_AVX2
+#endif
+
+typedef struct {
+  const char * name;
+  const char * args; // operand types, v for vector and i for integer
+} builtin_t;
+
+static const builtin_t builtins[] = {
+  [VEC_NEW] = {"make-vec", "ii"},
+  [VEC_REF] = {"vec-ref",  "vi"},
+  [VEC_SET] = {"vec-set!", "vii"},
+  [VEC_LEN] = {"vec-len",  "v"},
+  [VEC_SUM] = {"vec-sum",  "v"},
+  [VEC_ADD] = {"vec-add",  "vv"},
+  [VEC_MUL] = {"vec-mul",  "vv"},
+  [VEC_MIN] = {"vec-min",  "v"},
+  [VEC_MAX] = {"vec-max",  "v"},
+  [VEC_EQ]  = {"vec-eq",   "vv"},
+  [VEC_LT]  = {"vec-lt",   "vv"},
+  [VEC_GT]  = {"vec-gt",   "vv"},
+};
+
+// the builtin named by tok and its number of operands, -1 if none is
+int
+vec_find(tok_t * tok, size_t * args) {
+  size_t len = tok->len;
+  for (size_t i = 0; i < sizeof(builtins) / sizeof(* builtins); i++)
+    if (strlen(builtins[i].name) == len &&
+        !memcmp(builtins[i].name, tok->begin, len))
+      return * args = strlen(builtins[i].args), (int) i;
+  return -1;
+}
+
+// the add and mul kernels return whether any element overflowed, the
+// comparisons whether op holds for every pair
+typedef struct {
+  long long (* sum)(const int32_t * a, size_t len);
+  int (* add)(int32_t * r, const int32_t * a, const int32_t * b, size_t len);
+  int (* mul)(int32_t * r, const int32_t * a, const int32_t * b, size_t len);
+  int32_t (* ext)(const int32_t * a, size_t len, int max); // len > 0
+  int (* all)(const int32_t * a, const int32_t * b, size_t len, int op);
+} kernels_t;
+
+static long long
+sum_c(const int32_t * a, size_t len) {
+  long long sum = 0;
+  for (size_t i = 0; i < len; i++) sum += a[i];
+  return sum;
+}
+
+static int
+add_c(int32_t * r, const int32_t * a, const int32_t * b, size_t len) {
+  int over = 0;
+  for (size_t i = 0; i < len; i++) {
+    long long x = (long long) a[i] + b[i];
+    r[i] = (int32_t) x, over |= x != r[i];
+  }
+  return over;
+}
+
+static int
+mul_c(int32_t * r, const int32_t * a, const int32_t * b, size_t len) {
+  int over = 0;
+  for (size_t i = 0; i < len; i++) {
+    long long x = (long long) a[i] * b[i];
+    r[i] = (int32_t) x, over |= x != r[i];
+  }
+  return over;
+}
+
+static int32_t
+ext_c(const int32_t * a, size_t len, int max) {
+  int32_t r = a[0];
+  for (size_t i = 1; i < len; i++)
+    if (max ? a[i] > r : a[i] < r) r = a[i];
+  return r;
+}
+
+static int
+all_c(const int32_t * a, const int32_t * b, size_t len, int op) {
+  for (size_t i = 0; i < len; i++)
+    if (!(op == VEC_EQ ? a[i] == b[i] : op == VEC_LT ? a[i] < b[i] :
+          a[i] > b[i])) return 0;
+  return 1;
+}
+
+#ifdef __SSE2__
+static long long
+sum_sse2(const int32_t * a, size_t len) {
+  __m128i acc = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4) {
+    // widened to 64 bits so the partial sums cannot overflow
+    __m128i v = _mm_loadu_si128((const __m128i *) (a + i));
+    __m128i sign = _mm_srai_epi32(v, 31);
+    acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, sign));
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, sign));
+  }
+  long long lanes[2];
+  _mm_storeu_si128((__m128i *) lanes, acc);
+  return lanes[0] + lanes[1] + sum_c(a + i, len - i);
+}
+
+static int
+add_sse2(int32_t * r, const int32_t * a, const int32_t * b, size_t len) {
+  __m128i over = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (a + i));
+    __m128i y = _mm_loadu_si128((const __m128i *) (b + i));
+    __m128i z = _mm_add_epi32(x, y);
+    // the sum overflowed where its sign differs from both operands
+    over = _mm_or_si128(over, _mm_and_si128(_mm_xor_si128(x, z),
+                                            _mm_xor_si128(y, z)));
+    _mm_storeu_si128((__m128i *) (r + i), z);
+  }
+  int signs = _mm_movemask_epi8(_mm_srai_epi32(over, 31));
+  return add_c(r + i, a + i, b + i, len - i) | (signs != 0);
+}
+
+static int32_t
+ext_sse2(const int32_t * a, size_t len, int max) {
+  if (len < 4) return ext_c(a, len, max);
+  __m128i m = _mm_loadu_si128((const __m128i *) a);
+  size_t i = 4;
+  for (; i + 4 <= len; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (a + i));
+    __m128i take = max ? _mm_cmpgt_epi32(v, m) : _mm_cmpgt_epi32(m, v);
+    m = _mm_or_si128(_mm_and_si128(take, v), _mm_andnot_si128(take, m));
+  }
+  int32_t lanes[5];
+  _mm_storeu_si128((__m128i *) lanes, m);
+  if (i < len) lanes[4] = ext_c(a + i, len - i, max);
+  return ext_c(lanes, i < len ? 5 : 4, max);
+}
+
+static int
+all_sse2(const int32_t * a, const int32_t * b, size_t len, int op) {
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (a + i));
+    __m128i y = _mm_loadu_si128((const __m128i *) (b + i));
+    __m128i c = op == VEC_EQ ? _mm_cmpeq_epi32(x, y) :
+                op == VEC_LT ? _mm_cmpgt_epi32(y, x) : _mm_cmpgt_epi32(x, y);
+    if (_mm_movemask_epi8(c) != 0xffff) return 0;
+  }
+  return all_c(a + i, b + i, len - i, op);
+}
+
+// sse2 has no signed 32-bit multiply, mul stays scalar
+static const kernels_t kernels_sse2 = {
+  sum_sse2, add_sse2, mul_c, ext_sse2, all_sse2
+};
+#else
+static const kernels_t kernels_c = {sum_c, add_c, mul_c, ext_c, all_c};
+#endif
+
+#ifdef VEC_AVX2
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static long long
+sum_avx2(const int32_t * a, size_t len) {
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (a + i));
+    __m128i lo = _mm256_castsi256_si128(v);
+    __m128i hi = _mm256_extracti128_si256(v, 1);
+    acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(lo));
+    acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(hi));
+  }
+  long long lanes[4];
+  _mm256_storeu_si256((__m256i *) lanes, acc);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_c(a + i, len - i);
+}
+
+AVX2 static int
+add_avx2(int32_t * r, const int32_t * a, const int32_t * b, size_t len) {
+  __m256i over = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *) (a + i));
+    __m256i y = _mm256_loadu_si256((const __m256i *) (b + i));
+    __m256i z = _mm256_add_epi32(x, y);
+    over = _mm256_or_si256(over, _mm256_and_si256(_mm256_xor_si256(x, z),
+                                                  _mm256_xor_si256(y, z)));
+    _mm256_storeu_si256((__m256i *) (r + i), z);
+  }
+  int signs = _mm256_movemask_ps(_mm256_castsi256_ps(over));
+  return add_c(r + i, a + i, b + i, len - i) | (signs != 0);
+}
+
+// multiplies the even and odd lanes into 64-bit products, a product fits
+// when its high half is the sign of its low half
+AVX2 static int
+mul_avx2(int32_t * r, const int32_t * a, const int32_t * b, size_t len) {
+  __m256i ok = _mm256_set1_epi32(-1);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *) (a + i));
+    __m256i y = _mm256_loadu_si256((const __m256i *) (b + i));
+    __m256i even = _mm256_mul_epi32(x, y);
+    __m256i odd = _mm256_mul_epi32(_mm256_srli_epi64(x, 32),
+                                   _mm256_srli_epi64(y, 32));
+    ok = _mm256_and_si256(ok, _mm256_cmpeq_epi32(
+        _mm256_srli_epi64(even, 32), _mm256_srai_epi32(even, 31)));
+    ok = _mm256_and_si256(ok, _mm256_cmpeq_epi32(
+        _mm256_srli_epi64(odd, 32), _mm256_srai_epi32(odd, 31)));
+    __m256i z = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xaa);
+    _mm256_storeu_si256((__m256i *) (r + i), z);
+  }
+  // only the even lanes of ok hold checks
+  int fits = _mm256_movemask_ps(_mm256_castsi256_ps(ok)) & 0x55;
+  return mul_c(r + i, a + i, b + i, len - i) | (fits != 0x55);
+}
+
+AVX2 static int32_t
+ext_avx2(const int32_t * a, size_t len, int max) {
+  if (len < 8) return ext_c(a, len, max);
+  __m256i m = _mm256_loadu_si256((const __m256i *) a);
+  size_t i = 8;
+  for (; i + 8 <= len; i += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (a + i));
+    m = max ? _mm256_max_epi32(m, v) : _mm256_min_epi32(m, v);
+  }
+  int32_t lanes[9];
+  _mm256_storeu_si256((__m256i *) lanes, m);
+  if (i < len) lanes[8] = ext_c(a + i, len - i, max);
+  return ext_c(lanes, i < len ? 9 : 8, max);
+}
+
+AVX2 static int
+all_avx2(const int32_t * a, const int32_t * b, size_t len, int op) {
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *) (a + i));
+    __m256i y = _mm256_loadu_si256((const __m256i *) (b + i));
+    __m256i c = op == VEC_EQ ? _mm256_cmpeq_epi32(x, y) :
+                op == VEC_LT ? _mm256_cmpgt_epi32(y, x) :
+                _mm256_cmpgt_epi32(x, y);
+    if (_mm256_movemask_epi8(c) != -1) return 0;
+  }
+  return all_c(a + i, b + i, len - i, op);
+}
+
+static const kernels_t kernels_avx2 = {
+  sum_avx2, add_avx2, mul_avx2, ext_avx2, all_avx2
+};
+#endif
+
+static const kernels_t *
+kernels(void) {
+#ifdef VEC_AVX2
+  if (__builtin_cpu_supports("avx2")) return &kernels_avx2;
+#endif
+#ifdef __SSE2__
+  return &kernels_sse2;
+#else
+  return &kernels_c;
+#endif
+}
+
+// checks operand i of builtin id and protects a vector from collection
+// while the later operands are evaluated
+int
+vec_check(int id, size_t i, obj_t obj, tok_t * tok, gc_t * gc,
+          const char * file) {
+  char type = builtins[id].args[i] == 'v' ? OBJ_VEC : OBJ_INT;
+  if (obj_type(obj) != type)
+    return error(tok, file, "variable is not %s\n",
+                 type == OBJ_VEC ? "vector" : "integer"), 1;
+  if (type == OBJ_VEC && gc_protect(gc, obj_v(obj))) return 1;
+  return 0;
+}
+
+// runs builtin id on its checked operands, toks are those of the call and
+// of each operand
+int
+vec_apply(int id, tok_t ** toks, obj_t * args, gc_t * gc, const char * file,
+          obj_t * obj) {
+  const char * name = builtins[id].name;
+  tok_t * ptok = toks[0];
+  tok_t * atok = toks[1];
+  const kernels_t * k = kernels();
+  if (id == VEC_NEW) {
+    if (obj_i(args[0]) < 0)
+      return error(atok, file, "vector length is negative\n"), 1;
+    vec_t * v = gc_vec(gc, (size_t) obj_i(args[0]));
+    if (v == NULL) return 1;
+    int x = obj_i(args[1]);
+    for (size_t i = 0; x && i < v->len; i++) v->data[i] = x;
+    return * obj = mkvec(v), 0;
+  } else if (id == VEC_REF || id == VEC_SET) {
+    vec_t * v = obj_v(args[0]);
+    int i = obj_i(args[1]);
+    tok_t * itok = toks[2];
+    if (i < 0 || (size_t) i >= v->len)
+      return error(itok, file, "vector index %d is out of range\n", i), 1;
+    if (id == VEC_REF) return * obj = mkint(v->data[i]), 0;
+    return v->data[i] = obj_i(args[2]), * obj = OBJ_NIL, 0;
+  } else if (id == VEC_LEN) {
+    return * obj = mkint(obj_v(args[0])->len), 0;
+  } else if (id == VEC_SUM) {
+    vec_t * v = obj_v(args[0]);
+    long long sum = k->sum(v->data, v->len);
+    if (sum < INT_MIN || sum > INT_MAX)
+      return error(ptok, file, "integer overflow: %s\n", name), 1;
+    return * obj = mkint(sum), 0;
+  } else if (id == VEC_MIN || id == VEC_MAX) {
+    vec_t * v = obj_v(args[0]);
+    if (!v->len) return error(atok, file, "vector is empty\n"), 1;
+    return * obj = mkint(k->ext(v->data, v->len, id == VEC_MAX)), 0;
+  }
+  vec_t * a = obj_v(args[0]), * b = obj_v(args[1]);
+  if (a->len != b->len)
+    return error(ptok, file, "vector lengths do not match: %zu and %zu\n",
+                 a->len, b->len), 1;
+  if (id == VEC_ADD || id == VEC_MUL) {
+    vec_t * r = gc_vec(gc, a->len);
+    if (r == NULL) return 1;
+    if ((id == VEC_ADD ? k->add : k->mul)(r->data, a->data, b->data, a->len))
+      return error(ptok, file, "integer overflow: %s\n", name), 1;
+    return * obj = mkvec(r), 0;
+  }
+  return * obj = mkbol(k->all(a->data, b->data, a->len, id)), 0;
+}
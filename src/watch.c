@@ -0,0 +1,326 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "scan.h"
+#include "stats.h"
+#include "snap.h"
+#include "watch.h"
+
+// a script under edit is kept as its top-level forms, each analyzed once
+// for as long as its text and the globals named before it stay the same.
+// the globals are copied after a form whenever the forms run since the
+// last copy took longer than it did; an edit restores the copy nearest
+// before the first changed form, runs the unchanged forms after the copy
+// again with their output thrown away, and the rest as usual
+
+
+typedef struct {
+  uint64_t hash;      // of its text
+  const char * begin; // its text, in the current source
+  size_t   len;
+  node_t * node;      // parsed, NULL until then
+  int      analyzed;
+  size_t   names;     // globals named before it
+  uint64_t scope;     // hash of their names
+  char *   defs;      // the globals it names, each NUL terminated
+  size_t   ndefs;
+  size_t   size;      // bytes of defs
+  struct ckpt * ckpt; // the globals after it ran, if copied
+} form_t;
+
+struct watch {
+  const char * file;
+  char *   str;   // the current source, tokens point into it
+  form_t * forms;
+  size_t   len;
+  node_t * root;  // parent of the forms, which it does not hold
+  map_t    map;   // the globals
+  gc_t *   gc;
+  env_t *  env;   // the globals after done forms, NULL if there are none
+  size_t   done;
+  double   cost;  // seconds the last copy of the globals took
+  double   since; // seconds evaluated since then
+};
+
+// the top-level forms of str; from the first one that is no list or does
+// not end, the rest of str is one last form, which fails to parse
+static int
+split(const char * str, size_t len, form_t ** forms, size_t * n) {
+  size_t capa = 0;
+  const char * s = str, * begin, * end;
+  * forms = NULL, * n = 0;
+  for (int tok; (tok = scan(s, &begin, &end)) != TOK_EOF;) {
+    const char * form = begin;
+    int bad = 0;
+    for (size_t depth = 0;; tok = scan(s, &begin, &end)) {
+      if (tok == TOK_LPAREN) depth++;
+      else if (tok == TOK_RPAREN && depth) depth--;
+      else if (!depth || (tok != TOK_NUM && tok != TOK_SYM && tok != TOK_ID))
+        { bad = 1; break; }
+      s = end;
+      if (!depth) break;
+    }
+    if (* n + 1 > capa) {
+      size_t request = capa ? capa * 2 : 64;
+      form_t * ptr = realloc(* forms, sizeof(* ptr) * request);
+      if (ptr == NULL) return 1;
+      * forms = ptr, capa = request;
+    }
+    size_t flen = (size_t) ((bad ? str + len : s) - form);
+    (* forms)[(* n)++] = (form_t) {.hash = fnv(FNV_BASIS, form, flen),
+                                   .begin = form, .len = flen};
+    if (bad) break;
+  }
+  return 0;
+}
+
+// moves the tokens under node, parsed from the text at from, to the same
+// text at to
+static void
+rebase(node_t * node, const char * from, const char * to) {
+  node->tok.begin = to + (node->tok.begin - from);
+  for (node_t * n = node->front; n != NULL; n = n->next) rebase(n, from, to);
+}
+
+static void
+form_free(form_t * f) {
+  if (f->node != NULL) node_free(f->node);
+  free(f->defs), snap_drop(f->ckpt);
+}
+
+// the globals are spoiled, the forms after done no longer run on them
+static void
+spoil(struct watch * w, size_t done) {
+  if (w->gc != NULL) gc_free(w->gc);
+  w->gc = NULL, w->env = NULL, w->done = done;
+}
+
+// the forms of str take over the analysis of the old forms of the same
+// text, the copies of the globals too before the first change, which is
+// returned
+static size_t
+claim(struct watch * w, form_t * forms, size_t len) {
+  size_t k = 0, cursor;
+  while (k < len && k < w->done && forms[k].hash == w->forms[k].hash &&
+         forms[k].len == w->forms[k].len) k++;
+  if (k < w->done) spoil(w, k);
+  for (size_t i = 0; i < k; i++) {
+    form_t * f = &forms[i], * old = &w->forms[i];
+    rebase(old->node, old->begin, f->begin);
+    * f = * old, f->begin = forms[i].begin;
+    old->node = NULL, old->defs = NULL, old->ckpt = NULL;
+  }
+  // forms may come and go, the others keep their order
+  cursor = k;
+  for (size_t i = k; i < len; i++) {
+    form_t * f = &forms[i];
+    size_t j = cursor;
+    while (j < w->len && (w->forms[j].node == NULL ||
+                          w->forms[j].hash != f->hash ||
+                          w->forms[j].len != f->len)) j++;
+    if (j == w->len) continue;
+    form_t * old = &w->forms[j];
+    rebase(old->node, old->begin, f->begin);
+    f->node = old->node, f->analyzed = old->analyzed;
+    f->names = old->names, f->scope = old->scope;
+    f->defs = old->defs, f->ndefs = old->ndefs, f->size = old->size;
+    old->node = NULL, old->defs = NULL;
+    cursor = j + 1;
+  }
+  return k;
+}
+
+// the names form f added to the globals, kept with f
+static int
+keep_names(struct watch * w, form_t * f) {
+  map_t * map = &w->map;
+  size_t size = 0;
+  for (size_t i = f->names; i < map->len; i++)
+    size += (size_t) (map->end[i] - map->begin[i]) + 1;
+  char * defs = malloc(size + 1);
+  if (defs == NULL) return 1;
+  char * p = defs;
+  for (size_t i = f->names; i < map->len; i++) {
+    size_t len = (size_t) (map->end[i] - map->begin[i]);
+    memcpy(p, map->begin[i], len), p[len] = '\0';
+    map->begin[i] = p, map->end[i] = p + len, p += len + 1;
+  }
+  f->defs = defs, f->ndefs = map->len - f->names, f->size = size;
+  return 0;
+}
+
+// parses the text of f, nothing is kept of a form that fails
+static int
+parse_form(struct watch * w, form_t * f) {
+  const char * s = f->begin;
+  node_t * root = w->root;
+  root->front = root->back = NULL;
+  int err = parse(&s, root, w->file);
+  if (err && root->front != NULL) node_free(root->front);
+  return f->node = err ? NULL : root->front, err;
+}
+
+// parses the forms from k on that are not yet, then analyzes in order
+// those that are not or whose globals were named differently; the names
+// before k stand
+static int
+analyze_forms(struct watch * w, form_t * forms, size_t len, size_t k) {
+  double t = stats_clock();
+  for (size_t i = k; i < len; i++)
+    if (forms[i].node == NULL && parse_form(w, &forms[i]))
+      return stats_lap(PHA_PARSE, t), 1;
+  t = stats_lap(PHA_PARSE, t);
+  size_t names = 0;
+  uint64_t scope = FNV_BASIS;
+  if (k > 0) {
+    form_t * f = &forms[k - 1];
+    names = f->names + f->ndefs, scope = fnv(f->scope, f->defs, f->size);
+  }
+  w->map.len = names;
+  for (size_t i = k; i < len; i++) {
+    form_t * f = &forms[i];
+    if (f->analyzed && (f->names != names || f->scope != scope)) {
+      node_free(f->node), f->node = NULL;
+      free(f->defs), f->defs = NULL, f->analyzed = 0;
+      if (parse_form(w, f)) return stats_lap(PHA_SEMANTIC, t), 1;
+    }
+    // the names it added were new after the same names, and are again
+    if (f->analyzed) {
+      for (const char * p = f->defs; p < f->defs + f->size;
+           p += strlen(p) + 1)
+        if (map_add(&w->map, p, p + strlen(p), NULL))
+          return stats_lap(PHA_SEMANTIC, t), 1;
+    } else {
+      f->names = names, f->scope = scope;
+      if (semantic(f->node, &w->map, w->file) || keep_names(w, f)) {
+        node_free(f->node), f->node = NULL;
+        return stats_lap(PHA_SEMANTIC, t), 1;
+      }
+      if (!opt.plain) quicken(f->node);
+      f->analyzed = 1;
+    }
+    names += f->ndefs, scope = fnv(scope, f->defs, f->size);
+  }
+  stats_lap(PHA_SEMANTIC, t);
+  return 0;
+}
+
+// evaluates form i on the globals, and copies them after it once the
+// forms since the last copy took as long as that copy
+static int
+step(struct watch * w, size_t i) {
+  form_t * f = &w->forms[i];
+  double t = stats_now();
+  obj_t obj;
+  if (eval(f->node, w->env, w->env, w->gc, w->file, &obj)) return 1;
+  w->done = i + 1;
+  double after = stats_now();
+  if ((w->since += after - t) >= w->cost && f->ckpt == NULL &&
+      (f->ckpt = snap_take(w->env)) != NULL)
+    w->cost = stats_now() - after, w->since = 0;
+  return 0;
+}
+
+// fresh globals, restored from the copy nearest before form k and brought
+// up to it quietly
+static int
+restart(struct watch * w, size_t k) {
+  size_t j = k;
+  while (j > 0 && w->forms[j - 1].ckpt == NULL) j--;
+  if ((w->env = env_new(NULL, NULL, 0)) == NULL) return 1;
+  if ((w->gc = gc_new()) == NULL) return env_free(w->env), w->env = NULL, 1;
+  if (gc_add(w->gc, w->env, &w->env->id)) {
+    env_free(w->env);
+    return spoil(w, 0), 1;
+  }
+  double t = stats_now();
+  if (j > 0 && snap_put(w->forms[j - 1].ckpt, w->env, w->gc))
+    return spoil(w, 0), 1;
+  w->cost = stats_now() - t, w->since = 0, w->done = j;
+  if (env_add(w->env, w->map.len)) return spoil(w, 0), 1;
+  if (j == k) return 0;
+  fflush(stdout);
+  int out = dup(STDOUT_FILENO), null = open("/dev/null", O_WRONLY);
+  int err = out < 0 || null < 0 || dup2(null, STDOUT_FILENO) < 0;
+  if (null >= 0) close(null);
+  for (size_t i = j; i < k && !err; i++) err = step(w, i);
+  fflush(stdout);
+  if (out >= 0) dup2(out, STDOUT_FILENO), close(out);
+  return err ? (spoil(w, 0), 1) : 0;
+}
+
+struct watch *
+watch_new(const char * file) {
+  struct watch * w = calloc(1, sizeof(* w));
+  if (w == NULL) return NULL;
+  if ((w->root = node_new(NULL, NOD_NIL)) == NULL) return free(w), NULL;
+  w->file = file;
+  map_init(&w->map, NULL);
+  return w;
+}
+
+// runs str, which it takes over, as the next version of the script from
+// its first form that changed, or did not run; ran counts the forms run
+int
+watch_run(struct watch * w, char * str, size_t len, size_t * ran) {
+  form_t * forms;
+  size_t n;
+  * ran = 0;
+  if (split(str, len, &forms, &n) || lines_add(NULL, str, len))
+    return free(forms), free(str), 1;
+  size_t k = claim(w, forms, n);
+  for (size_t i = 0; i < w->len; i++) form_free(&w->forms[i]);
+  free(w->forms);
+  if (w->str != NULL) lines_drop(w->str), free(w->str);
+  w->forms = forms, w->len = n, w->str = str;
+  // the globals still stand for the forms before k
+  if (analyze_forms(w, forms, n, k)) return 1;
+  if (w->env == NULL && restart(w, w->done)) return 1;
+  if (env_add(w->env, w->map.len)) return spoil(w, 0), 1;
+  double t = stats_clock();
+  for (size_t i = w->done; i < n; i++, (* ran)++)
+    if (step(w, i)) return stats_lap(PHA_EVAL, t), spoil(w, i), 1;
+  stats_lap(PHA_EVAL, t);
+  return 0;
+}
+
+void
+watch_free(struct watch * w) {
+  spoil(w, 0);
+  for (size_t i = 0; i < w->len; i++) form_free(&w->forms[i]);
+  if (w->str != NULL) lines_drop(w->str), free(w->str);
+  w->root->front = w->root->back = NULL;
+  node_free(w->root), map_free(&w->map), free(w->forms), free(w);
+}
+
+// runs the script at path and again whenever it changes, with the reports
+// asked for after every run; runs until killed
+int
+watch(const char * path, int (* done)(void)) {
+  struct watch * w = watch_new(path);
+  if (w == NULL) return 1;
+  struct timespec seen = {0, 0}, poll = {0, WATCH_POLL * 1000000L};
+  off_t size = -1;
+  for (;; nanosleep(&poll, NULL)) {
+    struct stat st;
+    if (stat(path, &st) || (st.st_mtim.tv_sec == seen.tv_sec &&
+                            st.st_mtim.tv_nsec == seen.tv_nsec &&
+                            st.st_size == size)) continue;
+    seen = st.st_mtim, size = st.st_size;
+    stats_reset();
+    double t = stats_clock();
+    FILE * file = fopen(path, "rb");
+    if (file == NULL) continue;
+    size_t len, ran;
+    char * str = slurp(file, &len);
+    fclose(file);
+    if (str == NULL) continue;
+    stats_lap(PHA_READ, t);
+    watch_run(w, str, len, &ran);
+    done();
+  }
+}
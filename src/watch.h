@@ -0,0 +1,13 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stddef.h>
+
+#define WATCH_POLL 100 // milliseconds between looks at the script
+
+struct watch * watch_new(const char * file);
+int watch_run(struct watch * w, char * str, size_t len, size_t * ran);
+void watch_free(struct watch * w);
+int watch(const char * path, int (* done)(void));
+
+#endif
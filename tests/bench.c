@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scan.h"
+#include "stats.h"
+#include "buf.h"
+
+typedef struct {
+  const char * name;
+  int (* gen)(buf_t * buf, size_t scale);
+} work_t;
+
+static const char * phases[] = {"parse", "semantic", "eval", "gc"};
+static const int phaseids[] = {PHA_PARSE, PHA_SEMANTIC, PHA_EVAL, PHA_GC};
+
+#define PHASES (sizeof(phases) / sizeof(* phases))
+#define EVAL   2 // its place in phases
+
+// naive recursive fibonacci
+int
+gen_fib(buf_t * buf, size_t scale) {
+  return buf_printf(buf,
+      "(define fib (fun (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))\n"
+      "(fib %zu)\n", 16 + scale);
+}
+
+// deep closure nesting like tests/examples/10.lsp
+int
+gen_nest(buf_t * buf, size_t scale) {
+  size_t depth = 32 * scale;
+  for (size_t i = 0; i < depth; i++)
+    if (buf_printf(buf, "(")) return 1;
+  if (buf_printf(buf, "(fun (a0)")) return 1;
+  for (size_t i = 1; i < depth; i++)
+    if (buf_printf(buf, " (fun (a%zu)", i)) return 1;
+  if (buf_printf(buf, " (+")) return 1;
+  for (size_t i = 0; i < depth; i++)
+    if (buf_printf(buf, " a%zu", i)) return 1;
+  if (buf_printf(buf, ")")) return 1;
+  for (size_t i = 1; i < depth; i++)
+    if (buf_printf(buf, ")")) return 1;
+  if (buf_printf(buf, ")")) return 1;
+  for (size_t i = 0; i < depth; i++)
+    if (buf_printf(buf, " 1)")) return 1;
+  return buf_printf(buf, "\n");
+}
+
+// one closure allocated per recursive step
+int
+gen_closure(buf_t * buf, size_t scale) {
+  return buf_printf(buf,
+      "(define mk (fun (x) (fun (y) (+ x y))))\n"
+      "(define loop (fun (n acc)\n"
+      "  (if (= n 0) acc (loop (- n 1) (mod ((mk n) acc) 1000)))))\n"
+      "(loop %zu 0)\n", 500 * scale);
+}
+
+// many variables in a single scope
+int
+gen_wide(buf_t * buf, size_t scale) {
+  size_t len = 500 * scale;
+  for (size_t i = 0; i < len; i++)
+    if (buf_printf(buf, "(define v%zu %zu)\n", i, i % 10)) return 1;
+  if (buf_printf(buf, "(+")) return 1;
+  for (size_t i = 0; i < len; i++)
+    if (buf_printf(buf, " v%zu", i)) return 1;
+  return buf_printf(buf, ")\n");
+}
+
+// long arithmetic chains
+int
+gen_arith(buf_t * buf, size_t scale) {
+  for (size_t i = 0; i < 50 * scale; i++) {
+    if (buf_printf(buf, "(- (+")) return 1;
+    for (size_t j = 0; j < 100; j++)
+      if (buf_printf(buf, " (* %zu 2)", j % 7)) return 1;
+    if (buf_printf(buf, ") (mod %zu 3))\n", i)) return 1;
+  }
+  return 0;
+}
+
+static const work_t works[] = {
+  {"fib",     gen_fib},
+  {"nest",    gen_nest},
+  {"closure", gen_closure},
+  {"wide",    gen_wide},
+  {"arith",   gen_arith}
+};
+
+// runs the workload through feed() and records the phase times and, with
+// opt.hw, the hardware events
+int
+measure(const char * str, double * times, size_t * hw) {
+  stats_reset();
+  if (feed(str, "bench")) return 1;
+  for (size_t p = 0; p < PHASES; p++) {
+    times[p] = stats.time[phaseids[p]];
+    memcpy(hw + p * PMU_LEN, stats.hw[phaseids[p]], sizeof(* hw) * PMU_LEN);
+  }
+  // the gc lap runs inside the eval one, the phases add up to the run
+  times[EVAL] -= stats.time[PHA_GC];
+  for (int c = 0; c < PMU_LEN; c++)
+    hw[EVAL * PMU_LEN + (size_t) c] -= stats.hw[PHA_GC][c];
+  return 0;
+}
+
+int
+zucmp(const void * a, const void * b) {
+  size_t x = * (const size_t *) a, y = * (const size_t *) b;
+  return (x > y) - (x < y);
+}
+
+// median of counter c in phase p over the samples
+size_t
+events_median(const size_t * samples, size_t reps, size_t p, int c,
+    size_t * xs) {
+  for (size_t r = 0; r < reps; r++)
+    xs[r] = samples[(r * PHASES + p) * PMU_LEN + (size_t) c];
+  qsort(xs, reps, sizeof(* xs), zucmp);
+  return xs[reps / 2];
+}
+
+// median events per phase of the samples, null for missing counters
+void
+counters(FILE * out, const size_t * samples, size_t reps, size_t * xs) {
+  fprintf(out, ", \"counters\": {");
+  for (size_t p = 0; p < PHASES; p++) {
+    fprintf(out, "%s\"%s\": {", p ? ", " : "", phases[p]);
+    for (int c = 0; c < PMU_LEN; c++) {
+      fprintf(out, "%s\"%s\": ", c ? ", " : "", pmu_name(c));
+      if (pmu_has(c))
+        fprintf(out, "%zu", events_median(samples, reps, p, c, xs));
+      else fprintf(out, "null");
+    }
+    fprintf(out, "}");
+  }
+  fprintf(out, "}");
+}
+
+// the medians of eval on stderr, under its time
+void
+eval_line(const size_t * samples, size_t reps, size_t * xs) {
+  fprintf(stderr, "%-8s", "");
+  for (int c = 0; c < PMU_LEN; c++)
+    if (pmu_has(c))
+      fprintf(stderr, " %s %zu", pmu_name(c),
+              events_median(samples, reps, EVAL, c, xs));
+  fprintf(stderr, "\n");
+}
+
+int
+dblcmp(const void * a, const void * b) {
+  double x = * (const double *) a, y = * (const double *) b;
+  return (x > y) - (x < y);
+}
+
+double
+percentile(double * xs, size_t len, double p) {
+  size_t i = (size_t) (p * (double) (len - 1) + 0.5);
+  return xs[i < len ? i : len - 1];
+}
+
+// str as a JSON string
+void
+quote(FILE * out, const char * str) {
+  fputc('"', out);
+  for (; * str; str++)
+    if (* str == '"' || * str == '\\') fprintf(out, "\\%c", * str);
+    else if ((unsigned char) * str < 0x20)
+      fprintf(out, "\\u%04x", (unsigned) (unsigned char) * str);
+    else fputc(* str, out);
+  fputc('"', out);
+}
+
+void
+usage(const char * prog) {
+  fprintf(stderr,
+          "usage: %s [-r reps] [-s scale] [-l label] [-o file] [-c] "
+          "[workload...]\n"
+          "workloads:", prog);
+  for (size_t i = 0; i < sizeof(works) / sizeof(* works); i++)
+    fprintf(stderr, " %s", works[i].name);
+  fprintf(stderr, "\n");
+}
+
+int
+main(int argc, char ** argv) {
+  size_t reps = 10, scale = 1;
+  const char * label = "", * path = NULL;
+  int selected[sizeof(works) / sizeof(* works)] = {0}, any = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+      reps = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+      scale = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+      label = argv[++i];
+    } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      path = argv[++i];
+    } else if (!strcmp(argv[i], "-c")) {
+      opt.hw = 1;
+    } else {
+      size_t j = 0;
+      for (; j < sizeof(works) / sizeof(* works); j++)
+        if (!strcmp(argv[i], works[j].name)) break;
+      if (j == sizeof(works) / sizeof(* works)) return usage(argv[0]), 1;
+      selected[j] = any = 1;
+    }
+  }
+  if (!reps || !scale) return usage(argv[0]), 1;
+  opt.stats = 1;
+  FILE * out = path == NULL ? stdout : fopen(path, "w");
+  if (out == NULL) return perror(path), 1;
+  double * samples = malloc(sizeof(* samples) * reps * PHASES);
+  double * xs = malloc(sizeof(* xs) * reps);
+  size_t * events = malloc(sizeof(* events) * reps * PHASES * PMU_LEN);
+  size_t * ns = malloc(sizeof(* ns) * reps);
+  if (samples == NULL || xs == NULL || events == NULL || ns == NULL) return 1;
+  // without counters the report says why and the times go on
+  const char * why = opt.hw ? pmu_error() : NULL;
+  if (why != NULL) fprintf(stderr, "hw counters unavailable: %s\n", why);
+  int hw = opt.hw && why == NULL;
+  fprintf(out, "{\"label\": ");
+  quote(out, label);
+  fprintf(out, ", \"reps\": %zu, \"scale\": %zu, "
+          "\"unit\": \"us\", \"workloads\": [", reps, scale);
+  int first = 1;
+  for (size_t w = 0; w < sizeof(works) / sizeof(* works); w++) {
+    if (any && !selected[w]) continue;
+    buf_t buf = {NULL, 0, 0};
+    if (works[w].gen(&buf, scale)) return 1;
+    for (size_t r = 0; r < reps; r++)
+      if (measure(buf.str, samples + r * PHASES,
+                  events + r * PHASES * PMU_LEN))
+        return fprintf(stderr, "%s: workload failed\n", works[w].name), 1;
+    fprintf(out, "%s\n  {\"name\": \"%s\", \"bytes\": %zu, \"phases\": {",
+            first ? "" : ",", works[w].name, buf.len);
+    fprintf(stderr, "%-8s", works[w].name);
+    for (size_t p = 0; p < PHASES; p++) {
+      for (size_t r = 0; r < reps; r++) xs[r] = samples[r * PHASES + p] * 1e6;
+      qsort(xs, reps, sizeof(* xs), dblcmp);
+      double median = percentile(xs, reps, 0.5);
+      fprintf(out, "%s\"%s\": {\"min\": %.3f, \"median\": %.3f, "
+              "\"p95\": %.3f, \"max\": %.3f}", p ? ", " : "", phases[p],
+              xs[0], median, percentile(xs, reps, 0.95), xs[reps - 1]);
+      fprintf(stderr, " %s %10.1fus", phases[p], median);
+    }
+    fprintf(out, "}");
+    if (hw) counters(out, events, reps, ns);
+    fprintf(out, "}");
+    fprintf(stderr, "\n");
+    if (hw) eval_line(events, reps, ns);
+    free(buf.str);
+    first = 0;
+  }
+  fprintf(out, "\n]}\n");
+  free(samples);
+  free(xs);
+  free(events);
+  free(ns);
+  if (out != stdout) fclose(out);
+  return 0;
+}
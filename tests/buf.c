@@ -0,0 +1,20 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "buf.h"
+
+int
+buf_printf(buf_t * buf, const char * fmt, ...) {
+  for (;;) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf->str + buf->len, buf->capa - buf->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) return 1;
+    if (buf->len + (size_t) n < buf->capa) return buf->len += (size_t) n, 0;
+    size_t request = (buf->capa + (size_t) n + 1) * 2;
+    char * str = realloc(buf->str, request);
+    if (str == NULL) return 1;
+    buf->str = str, buf->capa = request;
+  }
+}
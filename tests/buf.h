@@ -0,0 +1,16 @@
+#ifndef BUF_H
+#define BUF_H
+
+#include <stddef.h>
+
+// a growing string the workload generators of bench and micro print into
+
+typedef struct {
+  char * str;
+  size_t len;
+  size_t capa;
+} buf_t;
+
+int buf_printf(buf_t * buf, const char * fmt, ...);
+
+#endif
@@ -0,0 +1,14 @@
+# runs SCRIPT with the interpreter MAIN and as the translated PROGRAM, and
+# fails unless both print the same and exit the same way
+
+execute_process(COMMAND ${MAIN} ${SCRIPT}
+  OUTPUT_VARIABLE want_out ERROR_VARIABLE want_err RESULT_VARIABLE want_ret)
+execute_process(COMMAND ${PROGRAM}
+  OUTPUT_VARIABLE got_out ERROR_VARIABLE got_err RESULT_VARIABLE got_ret)
+if (NOT "${want_out}" STREQUAL "${got_out}" OR
+    NOT "${want_err}" STREQUAL "${got_err}" OR
+    NOT "${want_ret}" STREQUAL "${got_ret}")
+  message(FATAL_ERROR "${PROGRAM} differs from ${MAIN} ${SCRIPT}:\n"
+    "${got_out}${got_err}exit ${got_ret}\ninstead of\n"
+    "${want_out}${want_err}exit ${want_ret}")
+endif()
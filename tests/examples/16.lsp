@@ -0,0 +1,14 @@
+(define seq (fun (x y) y))
+(define iota
+  (fun (v i)
+       (if (= i (vec-len v))
+           v
+           (seq (vec-set! v i i) (iota v (+ i 1))))))
+(define a (iota (make-vec 100 0) 0))
+(define b (make-vec 100 2))
+(print-num (vec-sum a))
+(print-num (vec-ref (vec-mul a b) 21))
+(print-num (vec-max (vec-add a b)))
+(print-num (vec-min a))
+(print-bool (vec-lt a (vec-add a b)))
+(print-bool (vec-eq a b))
@@ -0,0 +1,16 @@
+(define sum-to
+  (fun (n)
+       (define i 0)
+       (define sum 0)
+       (while (< i n)
+              (define i (+ i 1))
+              (define sum (+ sum i)))
+       sum))
+(print-num (sum-to 100))
+(define v (make-vec 10 0))
+(define i 0)
+(while (< i (vec-len v))
+       (vec-set! v i (* i i))
+       (define i (+ i 1)))
+(print-num (vec-sum v))
+(while #f (print-num 0))
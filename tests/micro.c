@@ -0,0 +1,269 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "scan.h"
+#include "buf.h"
+
+typedef struct {
+  const char * name;
+  int (* gen)(buf_t * buf, size_t bytes);
+} shape_t;
+
+typedef struct {
+  const char * name;
+  size_t bytes;
+} corpus_t;
+
+typedef struct {
+  double scan, parse, semantic; // seconds per pass over the corpus
+  size_t toks, nodes, ids;
+} result_t;
+
+#define REGRESSION 2 // exit status when below the baseline
+
+// long names read over and over
+int
+gen_ident(buf_t * buf, size_t bytes) {
+  if (buf_printf(buf, "(define alpha-count 1)\n(define beta-total 2)\n"
+                 "(define gamma-index-value 3)\n(define delta 4)\n"))
+    return 1;
+  while (buf->len < bytes)
+    if (buf_printf(buf, "(+ alpha-count beta-total gamma-index-value delta "
+                   "alpha-count beta-total)\n")) return 1;
+  return 0;
+}
+
+// literals of every width
+int
+gen_number(buf_t * buf, size_t bytes) {
+  for (size_t i = 0; buf->len < bytes; i++)
+    if (buf_printf(buf, "(+ %zu %zu -%zu 2147483647 0 %zu)\n",
+                   i % 10, i % 100000, i % 1000, i)) return 1;
+  return 0;
+}
+
+// forms 32 levels deep
+int
+gen_nest(buf_t * buf, size_t bytes) {
+  static const char ops[] = "+-*";
+  if (buf_printf(buf, "(define x 1)\n")) return 1;
+  while (buf->len < bytes) {
+    for (size_t i = 0; i < 32; i++)
+      if (buf_printf(buf, "(%c x ", ops[i % 3])) return 1;
+    if (buf_printf(buf, "1")) return 1;
+    for (size_t i = 0; i < 32; i++)
+      if (buf_printf(buf, ")")) return 1;
+    if (buf_printf(buf, "\n")) return 1;
+  }
+  return 0;
+}
+
+// a thousand globals defined and redefined
+int
+gen_define(buf_t * buf, size_t bytes) {
+  for (size_t i = 0; buf->len < bytes; i++)
+    if (buf_printf(buf, "(define v%zu %zu)\n", i % 1024, i)) return 1;
+  return 0;
+}
+
+static const shape_t shapes[] = {
+  {"ident",  gen_ident},
+  {"number", gen_number},
+  {"nest",   gen_nest},
+  {"define", gen_define}
+};
+
+static const corpus_t corpora[] = {
+  {"1K",   1 << 10},
+  {"1M",   1 << 20},
+  {"100M", 100 << 20}
+};
+
+#define SHAPES (sizeof(shapes) / sizeof(* shapes))
+#define SIZES  (sizeof(corpora) / sizeof(* corpora))
+
+double
+now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// count per second, 0 when the corpus has none
+double
+rate(size_t count, double secs) {
+  return count ? (double) count / secs : 0;
+}
+
+int
+scan_all(const char * str, size_t * toks) {
+  const char * begin, * end;
+  size_t n = 0;
+  for (;; str = end, n++) {
+    int tok = scan(str, &begin, &end);
+    if (tok == TOK_EOF) break;
+    if (tok == TOK_NIL) return 1;
+  }
+  return * toks = n, 0;
+}
+
+void
+count(node_t * node, size_t * nodes, size_t * ids) {
+  for (; node != NULL; node = node->next) {
+    (* nodes)++;
+    if (node->type == NOD_VAR) (* ids)++;
+    count(node->front, nodes, ids);
+  }
+}
+
+// times one pass of each stage over str, fresh tree and scopes every time
+int
+pass(const char * str, result_t * res) {
+  double t = now();
+  if (scan_all(str, &res->toks)) return 1;
+  res->scan = now() - t;
+  node_t * root = node_new(NULL, NOD_NIL);
+  if (root == NULL) return 1;
+  const char * s = str;
+  t = now();
+  if (parse_all(&s, root, "micro")) return node_free(root), 1;
+  res->parse = now() - t;
+  map_t map;
+  map_init(&map, NULL);
+  t = now();
+  for (node_t * node = root->front; node != NULL; node = node->next)
+    if (semantic(node, &map, "micro"))
+      return map_free(&map), node_free(root), 1;
+  res->semantic = now() - t;
+  res->nodes = res->ids = 0;
+  count(root->front, &res->nodes, &res->ids);
+  return map_free(&map), node_free(root), 0;
+}
+
+int
+dblcmp(const void * a, const void * b) {
+  double x = * (const double *) a, y = * (const double *) b;
+  return (x > y) - (x < y);
+}
+
+// the median of reps passes, small corpora are run often enough that
+// a sample covers about a megabyte
+int
+measure(const char * str, size_t len, size_t reps, result_t * res) {
+  size_t iters = len < (1 << 20) ? (1 << 20) / len : 1;
+  double * xs = malloc(sizeof(* xs) * reps * 3);
+  if (xs == NULL) return 1;
+  for (size_t r = 0; r < reps; r++) {
+    double sum[3] = {0, 0, 0};
+    for (size_t i = 0; i < iters; i++) {
+      if (pass(str, res)) return free(xs), 1;
+      sum[0] += res->scan, sum[1] += res->parse, sum[2] += res->semantic;
+    }
+    for (size_t k = 0; k < 3; k++)
+      xs[k * reps + r] = sum[k] / (double) iters;
+  }
+  for (size_t k = 0; k < 3; k++)
+    qsort(xs + k * reps, reps, sizeof(* xs), dblcmp);
+  res->scan = xs[reps / 2];
+  res->parse = xs[reps + reps / 2];
+  res->semantic = xs[2 * reps + reps / 2];
+  return free(xs), 0;
+}
+
+// the stored rate for shape and size, 0 if the baseline has none
+double
+baseline(FILE * in, const char * shape, const char * size, const char * what) {
+  char a[32], b[32], c[32];
+  double rate;
+  rewind(in);
+  while (fscanf(in, "%31s %31s %31s %lf", a, b, c, &rate) == 4)
+    if (!strcmp(a, shape) && !strcmp(b, size) && !strcmp(c, what))
+      return rate;
+  return 0;
+}
+
+void
+usage(const char * prog) {
+  fprintf(stderr,
+          "usage: %s [-r reps] [-L] [-w file] [-b file] [-t percent] "
+          "[shape...]\n"
+          "  -L        also run the 100M corpora\n"
+          "  -w file   store the rates as a baseline\n"
+          "  -b file   exit with %d when a rate drops more than -t percent "
+          "(default 20)\n"
+          "            below the baseline\n"
+          "shapes:", prog, REGRESSION);
+  for (size_t i = 0; i < SHAPES; i++) fprintf(stderr, " %s", shapes[i].name);
+  fprintf(stderr, "\n");
+}
+
+int
+main(int argc, char ** argv) {
+  size_t reps = 5, nsizes = SIZES - 1;
+  double tolerance = 20;
+  const char * save = NULL, * load = NULL;
+  int selected[SHAPES] = {0}, any = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+      reps = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-L")) {
+      nsizes = SIZES;
+    } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+      save = argv[++i];
+    } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+      load = argv[++i];
+    } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+      tolerance = strtod(argv[++i], NULL);
+    } else {
+      size_t j = 0;
+      for (; j < SHAPES; j++) if (!strcmp(argv[i], shapes[j].name)) break;
+      if (j == SHAPES) return usage(argv[0]), 1;
+      selected[j] = any = 1;
+    }
+  }
+  if (!reps) return usage(argv[0]), 1;
+  FILE * in = NULL, * out = NULL;
+  if (load != NULL && (in = fopen(load, "r")) == NULL) return perror(load), 1;
+  if (save != NULL && (out = fopen(save, "w")) == NULL) return perror(save), 1;
+  printf("%-7s %5s %10s %12s %13s %13s\n", "shape", "size",
+         "scan MB/s", "scan tok/s", "parse node/s", "sem ident/s");
+  int ret = 0;
+  for (size_t w = 0; w < SHAPES; w++) {
+    if (any && !selected[w]) continue;
+    for (size_t z = 0; z < nsizes; z++) {
+      buf_t buf = {NULL, 0, 0};
+      if (shapes[w].gen(&buf, corpora[z].bytes)) return 1;
+      result_t res = {0, 0, 0, 0, 0, 0};
+      if (measure(buf.str, buf.len, reps, &res))
+        return fprintf(stderr, "%s: corpus failed\n", shapes[w].name), 1;
+      double rates[3] = {
+        rate(res.toks, res.scan),
+        rate(res.nodes, res.parse),
+        rate(res.ids, res.semantic)
+      };
+      static const char * whats[3] = {"scan", "parse", "semantic"};
+      printf("%-7s %5s %10.1f %12.0f %13.0f %13.0f\n",
+             shapes[w].name, corpora[z].name,
+             (double) buf.len / res.scan / 1e6, rates[0], rates[1], rates[2]);
+      for (size_t k = 0; k < 3; k++) {
+        if (out != NULL)
+          fprintf(out, "%s %s %s %.0f\n",
+                  shapes[w].name, corpora[z].name, whats[k], rates[k]);
+        double base = in == NULL ? 0 :
+                      baseline(in, shapes[w].name, corpora[z].name, whats[k]);
+        if (base > 0 && rates[k] < base * (1 - tolerance / 100)) {
+          fprintf(stderr, "%s %s %s: %.0f/s is %.1f%% below the baseline\n",
+                  shapes[w].name, corpora[z].name, whats[k], rates[k],
+                  (1 - rates[k] / base) * 100);
+          ret = REGRESSION;
+        }
+      }
+      free(buf.str);
+    }
+  }
+  if (in != NULL) fclose(in);
+  if (out != NULL) fclose(out);
+  return ret;
+}
@@ -1,71 +1,238 @@
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 #include "scan.h"
+#include "watch.h"
+#include "mem.h"
+#include "memo.h"
 
 START_TEST(test_scan) {
   const char * spaces = " \t 0";
-  const char * begin, * end, * line;
-  size_t lnum = 0;
-  ck_assert(scan(spaces, &begin, &end, &line, &lnum) == TOK_NUM &&
+  const char * begin, * end;
+  ck_assert(scan(spaces, &begin, &end) == TOK_NUM &&
             begin == spaces + 3 && end == spaces + 4);
 
   const char * number = "0";
-  ck_assert(scan(number, &begin, &end, &line, &lnum) == TOK_NUM &&
+  ck_assert(scan(number, &begin, &end) == TOK_NUM &&
             begin == number && end == number + 1);
 
   const char * lparen = "(";
-  ck_assert(scan(lparen, &begin, &end, &line, &lnum) == TOK_LPAREN &&
+  ck_assert(scan(lparen, &begin, &end) == TOK_LPAREN &&
             begin == lparen && end == lparen + 1);
 
   const char * rparen = ")";
-  ck_assert(scan(rparen, &begin, &end, &line, &lnum) == TOK_RPAREN &&
+  ck_assert(scan(rparen, &begin, &end) == TOK_RPAREN &&
             begin == rparen && end == rparen + 1);
 
   const char * nil = "";
-  ck_assert(scan(nil, &begin, &end, &line, &lnum) == TOK_EOF &&
+  ck_assert(scan(nil, &begin, &end) == TOK_EOF &&
             begin == nil && end == nil);
 
   const char * op = "+";
-  ck_assert(scan(op, &begin, &end, &line, &lnum) == TOK_ID &&
+  ck_assert(scan(op, &begin, &end) == TOK_ID &&
             begin == op && end == op + 1);
 
   const char * id = "foo";
-  ck_assert(scan(id, &begin, &end, &line, &lnum) == TOK_ID &&
+  ck_assert(scan(id, &begin, &end) == TOK_ID &&
             begin == id && end == id + 3);
 
+  const char * bang = "vec-set! v";
+  ck_assert(scan(bang, &begin, &end) == TOK_ID &&
+            begin == bang && end == bang + 8);
+
   malloc(1000);
 } END_TEST
 
 START_TEST(test_paren) {
-  const char * incomplete = "(", * file = "test", * line;
+  const char * incomplete = "(", * file = "test";
   node_t * node = node_new(NULL, NOD_NIL);
-  size_t lnum = 0;
   ck_assert(node != NULL &&
-            parse(&incomplete, node, file, &line, &lnum));
+            parse(&incomplete, node, file));
 
   const char * complete = "()";
   node = node_new(NULL, NOD_NIL);
   node_dump(node);
   ck_assert(node != NULL &&
-            !parse(&complete, node, file, &line, &lnum));
+            !parse(&complete, node, file));
   node_dump(node);
 
   const char * expr = "(+ 1 (add 3 4) 3)";
   node = node_new(NULL, NOD_NIL);
   node_dump(node);
   ck_assert(node != NULL &&
-            !parse(&expr, node, file, &line, &lnum));
+            !parse(&expr, node, file));
   node_dump(node);
 
   node_free(node);
 } END_TEST
 
+START_TEST(test_lines) {
+  const char * str = "(a)\n\n  (b\n   c)\n", * name, * line;
+  size_t lnum;
+  ck_assert(lines_find(str + 9, &name, &line, &lnum) == 1 &&
+            line == str + 9 && lnum == 0);
+
+  ck_assert(!lines_add("test", str, strlen(str)));
+  ck_assert(!lines_find(str + 1, &name, &line, &lnum) &&
+            !strcmp(name, "test") && line == str && lnum == 0);
+  ck_assert(!lines_find(str + 9, &name, &line, &lnum) &&
+            line == str + 5 && lnum == 2);
+  ck_assert(!lines_find(str + 14, &name, &line, &lnum) &&
+            line == str + 10 && lnum == 3);
+  ck_assert(!lines_find(str + 16, &name, &line, &lnum) &&
+            line == str + 16 && lnum == 4);
+
+  lines_drop(str);
+  ck_assert(lines_find(str + 1, &name, &line, &lnum) == 1);
+} END_TEST
+
+// a version of a watched script, which watch_run() takes over
+static char *
+version(const char * str, size_t * len) {
+  char * copy = malloc((* len = strlen(str)) + 1);
+  return copy == NULL ? NULL : memcpy(copy, str, * len + 1);
+}
+
+START_TEST(test_watch) {
+  struct watch * w = watch_new("test");
+  size_t len, ran;
+  char * str;
+  ck_assert(w != NULL);
+
+  str = version("(define a 1) (define b (+ a 1))\n(define c (* b 2))", &len);
+  ck_assert(!watch_run(w, str, len, &ran) && ran == 3);
+  str = version("(define a 1) (define b (+ a 1))\n(define c (* b 2))", &len);
+  ck_assert(!watch_run(w, str, len, &ran) && ran == 0);
+  str = version("(define a 1)\n(define b (+ a 1)) (define c (* b 3))", &len);
+  ck_assert(!watch_run(w, str, len, &ran) && ran == 1);
+
+  str = version("(define a 1) (define b (/ a 0)) (define c (* b 3))", &len);
+  ck_assert(watch_run(w, str, len, &ran) && ran == 0);
+  str = version("(define a 1) (define b (/ a 1)) (define c (* b 3))", &len);
+  ck_assert(!watch_run(w, str, len, &ran) && ran == 2);
+
+  str = version("(define a 1) (define b (/ a 1)) (define c", &len);
+  ck_assert(watch_run(w, str, len, &ran) && ran == 0);
+  str = version("(define a 1) (define b (/ a 1)) (define c (* b 3)) (c)",
+                &len);
+  ck_assert(watch_run(w, str, len, &ran) && ran == 1);
+  str = version("(define a 1) (define b (/ a 1)) (define c (* b 3)) c",
+                &len);
+  ck_assert(watch_run(w, str, len, &ran) && ran == 0);
+  str = version("(define a 1) (define b (/ a 1)) (define c (* b 3))\n"
+                "(define d (fun () c))", &len);
+  ck_assert(!watch_run(w, str, len, &ran) && ran == 1);
+
+  watch_free(w);
+} END_TEST
+
+// malloc() counting its calls
+static void *
+count_alloc(void * ctx, size_t size) {
+  return ++* (size_t *) ctx, malloc(size);
+}
+
+static void *
+count_resize(void * ctx, void * ptr, size_t size) {
+  return ++* (size_t *) ctx, realloc(ptr, size);
+}
+
+static void
+count_release(void * ctx, void * ptr) {
+  --* (size_t *) ctx, free(ptr);
+}
+
+START_TEST(test_mem) {
+  size_t calls = 0;
+  mem_ops_t ops = {count_alloc, count_resize, count_release, &calls};
+  const char * expr = "(+ 1 (add 3 4) 3)", * file = "test";
+  mem_stats_t before, after;
+  opt.mem = &ops;
+  mem_get(&before);
+  node_t * node = node_new(NULL, NOD_NIL);
+  ck_assert(node != NULL && !parse(&expr, node, file));
+  mem_get(&after);
+  ck_assert(calls > 0 && after.bytes[MEM_AST] > before.bytes[MEM_AST] &&
+            after.made[MEM_AST] > before.made[MEM_AST]);
+  node_free(node);
+  mem_get(&after);
+  ck_assert(after.bytes[MEM_AST] == before.bytes[MEM_AST] &&
+            after.live == before.live);
+
+  expr = "(+ 1 (add 3 4) 3)";
+  opt.mem_limit = before.live + 200;
+  node = node_new(NULL, NOD_NIL);
+  ck_assert(node != NULL && parse(&expr, node, file));
+  node_free(node);
+  mem_get(&after);
+  ck_assert(after.refused > before.refused && after.live == before.live);
+
+  // memo tables count too, the first call past the limit fails the run
+  opt.mem_limit = 0;
+  node = node_new(NULL, NOD_NIL);
+  map_t map;
+  map_init(&map, NULL);
+  env_t * env = env_new(NULL, NULL, 0);
+  gc_t * gc = gc_new();
+  ck_assert(node != NULL && env != NULL && gc != NULL &&
+            !gc_add(gc, env, &env->id));
+  mem_get(&before);
+  opt.mem_limit = before.live + 16384, opt.memo = opt.strict = 1;
+  ck_assert(run("(define f (fun (a) a)) (define b (f 1))",
+                node, &map, env, gc, file));
+  mem_get(&after);
+  ck_assert(after.refused > before.refused &&
+            after.made[MEM_MEMO] > before.made[MEM_MEMO]);
+  opt.memo = opt.strict = 0;
+  memo_free(), gc_free(gc), map_free(&map), node_free(node);
+  opt.mem_limit = 0, opt.mem = NULL;
+} END_TEST
+
+// nodes of type under and after node
+static size_t
+count(node_t * node, int type) {
+  size_t n = 0;
+  for (; node != NULL; node = node->next)
+    n += (node->type == type) + count(node->front, type);
+  return n;
+}
+
+START_TEST(test_inline) {
+  const char * str =
+      "(define sq (fun (x) (* x x)))\n"
+      "(define mk (fun (x) (fun (y) (+ x y))))\n"
+      "(define f (fun (n) (+ (sq n) ((mk n) 1) ((fun (a) (* a n)) 2))))\n"
+      "(define g (fun (n) (define h 0)\n"
+      "  (while (< n 3) (define h (mk n)) (define n (+ n 1))) (h 10)))\n"
+      "(define a (f 3))\n"
+      "(define b (g 0))\n";
+  node_t * root = node_new(NULL, NOD_NIL);
+  map_t map;
+  map_init(&map, NULL);
+  env_t * env = env_new(NULL, NULL, 0);
+  gc_t * gc = gc_new();
+  ck_assert(root != NULL && env != NULL && gc != NULL &&
+            !gc_add(gc, env, &env->id));
+  opt.inl = opt.strict = 1;
+  ck_assert(!run(str, root, &map, env, gc, "test"));
+  opt.inl = opt.strict = 0;
+  // the closure made in a loop keeps its call
+  ck_assert(count(root, NOD_INL) == 3 && count(root, NOD_FUN) == 5);
+  ck_assert(env->locs[4].obj == mkint(9 + 4 + 6) &&
+            env->locs[5].obj == mkint(12));
+  gc_free(gc), map_free(&map), node_free(root);
+} END_TEST
+
 Suite *
 make_scan_suite(void) {
   Suite * suite = suite_create("scan");
   TCase * tcase = tcase_create("scan");
   tcase_add_test(tcase, test_scan);
   tcase_add_test(tcase, test_paren);
+  tcase_add_test(tcase, test_lines);
+  tcase_add_test(tcase, test_watch);
+  tcase_add_test(tcase, test_mem);
+  tcase_add_test(tcase, test_inline);
   suite_add_tcase(suite, tcase);
   return suite;
 }